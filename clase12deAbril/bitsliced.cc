@@ -0,0 +1,216 @@
+#include "bitsliced.h"
+
+#include <chrono>
+#include <cstring>
+
+namespace {
+typedef uint16_t Vector
+    __attribute__((vector_size(2 * BitSlicedSolver::lanes)));
+
+const uint16_t full = 0x1ff;
+
+// The cells of the 27 units (rows, columns and boxes) and the units of every
+// cell.
+struct Units {
+  uint8_t cells[27][9];
+  uint8_t of[81][3];
+
+  Units() {
+    for (size_t i = 0; i < 9; i++)
+      for (size_t k = 0; k < 9; k++) {
+        cells[i][k] = 9 * i + k;
+        cells[9 + i][k] = 9 * k + i;
+        cells[18 + i][k] = 27 * (i / 3) + 3 * (i % 3) + 9 * (k / 3) + k % 3;
+      }
+    for (size_t u = 0; u < 27; u++)
+      for (size_t k = 0; k < 9; k++) of[cells[u][k]][u / 9] = u;
+  }
+};
+
+const Units units;
+
+bool any(const Vector& v) {
+  uint64_t words[sizeof(Vector) / 8];
+  std::memcpy(words, &v, sizeof(v));
+  uint64_t all = 0;
+  for (uint64_t w : words) all |= w;
+  return all != 0;
+}
+
+// All ones in the lanes where m has a single candidate or none.
+Vector single(const Vector& m) { return (Vector)((m & (m - 1)) == 0); }
+
+double now() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+}
+
+BitSlicedSolver::BitSlicedSolver(size_t nodes)
+    : maxNodes(nodes)
+    , results(nullptr) {}
+
+std::vector<BitSlicedSolver::Result> BitSlicedSolver::solve(
+    const std::vector<std::vector<int>>& puzzles) {
+  std::vector<Result> out(puzzles.size());
+  results = &out;
+  size_t next = 0;
+  bool running = false;
+  for (size_t l = 0; l < lanes; l++) {
+    state[l].active = false;
+    for (Vector& c : cells) c[l] = full;
+    if (next < puzzles.size()) {
+      load(l, puzzles[next], next);
+      next++;
+    }
+    running = running || state[l].active;
+  }
+
+  while (running) {
+    Vector failed, solved;
+    propagate(failed, solved);
+    running = false;
+    for (size_t l = 0; l < lanes; l++) {
+      if (!state[l].active) continue;
+      out[state[l].puzzle].rounds++;
+      step(l, failed[l] != 0, solved[l] != 0);
+      // A lane never waits: it starts the next puzzle at once.
+      if (!state[l].active && next < puzzles.size()) {
+        load(l, puzzles[next], next);
+        next++;
+      }
+      running = running || state[l].active;
+    }
+  }
+  results = nullptr;
+  return out;
+}
+
+void BitSlicedSolver::load(size_t lane, const std::vector<int>& puzzle,
+                           size_t index) {
+  for (size_t c = 0; c < 81; c++)
+    cells[c][lane] = puzzle[c] == 0 ? full : 1 << (puzzle[c] - 1);
+  Lane& l = state[lane];
+  l.active = true;
+  l.puzzle = index;
+  l.stack.clear();
+  l.start = now();
+  (*results)[index] = {Unsolvable, puzzle, 0, 0, 0, 0};
+}
+
+/**
+ * Naked and hidden singles on every lane until none of them changes. Lanes
+ * with an empty cell, a value twice in a unit or a value with no place in a
+ * unit come out all ones in failed, and solved ones in solved.
+ */
+void BitSlicedSolver::propagate(Vector& failed, Vector& solved) {
+  const Vector zero = {};
+  const Vector all = zero + full;
+  failed = zero;
+  Vector changed;
+  do {
+    changed = zero;
+    // Naked singles: a value fixed in a unit leaves the other cells of it.
+    Vector fixed[27];
+    for (size_t u = 0; u < 27; u++) {
+      Vector seen = zero;
+      for (size_t k = 0; k < 9; k++) {
+        const Vector& m = cells[units.cells[u][k]];
+        Vector s = m & single(m);
+        failed |= seen & s;
+        seen |= s;
+      }
+      fixed[u] = seen;
+    }
+    for (size_t c = 0; c < 81; c++) {
+      Vector m = cells[c];
+      Vector keep = single(m);
+      Vector others = fixed[units.of[c][0]] | fixed[units.of[c][1]] |
+                      fixed[units.of[c][2]];
+      Vector next = (m & keep) | (m & ~others & ~keep);
+      failed |= (Vector)(next == 0);
+      changed |= next ^ m;
+      cells[c] = next;
+    }
+
+    // Hidden singles: a value that fits a single cell of a unit goes there.
+    for (size_t u = 0; u < 27; u++) {
+      Vector once = zero, twice = zero;
+      for (size_t k = 0; k < 9; k++) {
+        const Vector& m = cells[units.cells[u][k]];
+        twice |= once & m;
+        once |= m;
+      }
+      failed |= (Vector)(once != all);
+      Vector hidden = once & ~twice;
+      for (size_t k = 0; k < 9; k++) {
+        Vector& m = cells[units.cells[u][k]];
+        Vector h = m & hidden;
+        Vector has = (Vector)(h != 0);
+        Vector next = (h & has) | (m & ~has);
+        changed |= next ^ m;
+        m = next;
+      }
+    }
+    failed = (Vector)(failed != 0);
+  } while (any(changed & ~failed));
+
+  solved = ~zero;
+  for (const Vector& m : cells) solved &= single(m);
+}
+
+void BitSlicedSolver::step(size_t lane, bool failed, bool solved) {
+  Lane& l = state[lane];
+  Result& r = (*results)[l.puzzle];
+  if (failed) {
+    r.failures++;
+    if (l.stack.empty()) {
+      finish(lane, Unsolvable);
+      return;
+    }
+    // Back to the last decision, with its value removed.
+    const Frame& f = l.stack.back();
+    for (size_t c = 0; c < 81; c++) cells[c][lane] = f.cells[c];
+    cells[f.cell][lane] &= ~f.bit;
+    l.stack.pop_back();
+    return;
+  }
+  if (solved) {
+    for (size_t c = 0; c < 81; c++)
+      r.grid[c] = __builtin_ctz(cells[c][lane]) + 1;
+    finish(lane, Solved);
+    return;
+  }
+  if ((maxNodes > 0 && r.decisions >= maxNodes) || (stop && stop(r))) {
+    finish(lane, OutOfBudget);
+    return;
+  }
+
+  // The cell with the fewest candidates, its smallest value first.
+  r.decisions++;
+  size_t best = 0;
+  int fewest = 10;
+  for (size_t c = 0; c < 81; c++) {
+    int n = __builtin_popcount(cells[c][lane]);
+    if (n > 1 && n < fewest) {
+      best = c;
+      fewest = n;
+    }
+  }
+  Frame f;
+  for (size_t c = 0; c < 81; c++) f.cells[c] = cells[c][lane];
+  f.cell = best;
+  f.bit = cells[best][lane] & -cells[best][lane];
+  l.stack.push_back(f);
+  cells[best][lane] = f.bit;
+}
+
+void BitSlicedSolver::finish(size_t lane, Outcome outcome) {
+  Lane& l = state[lane];
+  Result& r = (*results)[l.puzzle];
+  r.outcome = outcome;
+  r.micros = now() - l.start;
+  l.active = false;
+  l.stack.clear();
+}
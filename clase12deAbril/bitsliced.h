@@ -0,0 +1,93 @@
+#ifndef BITSLICED_H_
+#define BITSLICED_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * Solves many 9x9 puzzles at once, one per lane of a SIMD vector.
+ *
+ * The candidates of a cell are a 9-bit mask, and the board keeps, for every
+ * cell, a vector with the mask of that cell in each of the lanes (an array of
+ * structures of arrays). Propagation, naked and hidden singles, runs on whole
+ * vectors without branches, so all the lanes advance together. Decisions and
+ * backtracking are done lane by lane, each lane with its own stack. A lane
+ * that finishes its puzzle, solved or not, takes the next one of the input
+ * right away, so that the vectors stay full until the input runs out.
+ *
+ * Puzzles and solutions are flat grids, row by row, with 0 for empty cells.
+ */
+class BitSlicedSolver {
+public:
+  // As many 16-bit lanes as the widest vectors of the target hold.
+#ifdef __AVX2__
+  enum { lanes = 16 };
+#else
+  enum { lanes = 8 };
+#endif
+  enum Outcome { Solved, Unsolvable, OutOfBudget };
+
+  struct Result {
+    Outcome outcome;
+    // The solution, or the puzzle if there is none.
+    std::vector<int> grid;
+    uint64_t decisions;
+    uint64_t failures;
+    // Propagation rounds the puzzle took part in.
+    uint64_t rounds;
+    // From the moment the puzzle got a lane until it left it.
+    double micros;
+  };
+
+  /**
+   * A solver that gives up on a puzzle after maxNodes decisions, zero for no
+   * limit.
+   */
+  explicit BitSlicedSolver(size_t maxNodes = 0);
+
+  /**
+   * Makes a lane give up on its puzzle, out of budget, as soon as out returns
+   * true for the result so far. It is asked before every decision.
+   */
+  void stopWhen(const std::function<bool(const Result&)>& out) { stop = out; }
+
+  /**
+   * Solves puzzles, which must all be 9x9 grids, and returns their results
+   * in the same order.
+   */
+  std::vector<Result> solve(const std::vector<std::vector<int>>& puzzles);
+
+private:
+  typedef uint16_t Vector __attribute__((vector_size(2 * lanes)));
+
+  struct Frame {
+    uint16_t cells[81];
+    uint8_t cell;
+    uint16_t bit;
+  };
+
+  struct Lane {
+    bool active;
+    size_t puzzle;
+    std::vector<Frame> stack;
+    double start;
+  };
+
+  BitSlicedSolver(const BitSlicedSolver&);
+  BitSlicedSolver& operator=(const BitSlicedSolver&);
+
+  void load(size_t lane, const std::vector<int>& puzzle, size_t index);
+  void propagate(Vector& failed, Vector& solved);
+  void finish(size_t lane, Outcome outcome);
+  void step(size_t lane, bool failed, bool solved);
+
+  size_t maxNodes;
+  std::function<bool(const Result&)> stop;
+  Vector cells[81];
+  Lane state[lanes];
+  std::vector<Result>* results;
+};
+
+#endif  // BITSLICED_H_
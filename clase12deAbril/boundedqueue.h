@@ -0,0 +1,106 @@
+#ifndef BOUNDEDQUEUE_H_
+#define BOUNDEDQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+ * A bounded lock-free queue for any number of producers and consumers.
+ *
+ * Every slot carries a sequence number that tells whether it is ready to be
+ * written or read in the current lap around the ring (Vyukov's algorithm).
+ * Producers and consumers claim positions with a compare and swap on their
+ * own counter, kept on separate cache lines, and never block: push fails
+ * when the queue is full and pop when it is empty.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+  /**
+   * A queue of at least capacity slots, rounded up to a power of two.
+   */
+  explicit BoundedQueue(size_t capacity)
+      : mask(1)
+      , head(0)
+      , tail(0) {
+    while (mask < capacity) mask <<= 1;
+    slots.reset(new Slot[mask]);
+    for (size_t i = 0; i < mask; i++)
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    mask--;
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  /**
+   * Elements in the queue, only approximate while others use it.
+   */
+  size_t size() const {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_relaxed);
+    return h > t ? h - t : 0;
+  }
+
+  bool push(const T& value) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots[pos & mask];
+      size_t seq = slot->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    slot->value = value;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& value) {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+      slot = &slots[pos & mask];
+      size_t seq = slot->sequence.load(std::memory_order_acquire);
+      std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    value = slot->value;
+    // The slot is free for the producers of the next lap.
+    slot->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  BoundedQueue(const BoundedQueue&);
+  BoundedQueue& operator=(const BoundedQueue&);
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;
+  // Next position to write and to read.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+#endif  // BOUNDEDQUEUE_H_
@@ -0,0 +1,130 @@
+#include "negativecache.h"
+
+#include <cstdio>
+#include <fstream>
+
+namespace {
+const char magic[8] = {'S', 'U', 'D', 'O', 'K', 'U', 'N', 'C'};
+
+template <typename T>
+void write(std::ofstream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool read(std::ifstream& in, T& value) {
+  return bool(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+}
+
+NegativeCache::NegativeCache(size_t size, size_t k)
+    : lookups(0)
+    , filtered(0)
+    , hits(0)
+    , bits((size + 63) / 64, 0)
+    , hashes(k) {}
+
+std::string NegativeCache::key(const std::vector<int>& puzzle) {
+  return std::string(puzzle.begin(), puzzle.end());
+}
+
+// FNV-1a followed by the splitmix64 finalizer.
+uint64_t NegativeCache::hash(const std::string& key, uint64_t seed) {
+  uint64_t h = 14695981039346656037ULL ^ seed;
+  for (char c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+// The k positions are h1 + i * h2 (double hashing).
+bool NegativeCache::test(const std::string& key) const {
+  uint64_t h1 = hash(key, 0), h2 = hash(key, 1) | 1, m = bits.size() * 64;
+  for (size_t i = 0; i < hashes; i++) {
+    uint64_t b = (h1 + i * h2) % m;
+    if (!(bits[b / 64] >> (b % 64) & 1)) return false;
+  }
+  return true;
+}
+
+void NegativeCache::set(const std::string& key) {
+  uint64_t h1 = hash(key, 0), h2 = hash(key, 1) | 1, m = bits.size() * 64;
+  for (size_t i = 0; i < hashes; i++) {
+    uint64_t b = (h1 + i * h2) % m;
+    bits[b / 64] |= uint64_t(1) << (b % 64);
+  }
+}
+
+NegativeCache::Verdict NegativeCache::lookup(const std::vector<int>& puzzle) {
+  lookups++;
+  std::string k = key(puzzle);
+  if (!test(k)) {
+    filtered++;
+    return Unknown;
+  }
+  auto it = table.find(k);
+  if (it == table.end()) return Unknown;
+  hits++;
+  return it->second;
+}
+
+void NegativeCache::insert(const std::vector<int>& puzzle, Verdict verdict) {
+  if (verdict == Unknown) return;
+  std::string k = key(puzzle);
+  set(k);
+  table[k] = verdict;
+}
+
+bool NegativeCache::save(const std::string& path) const {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    out.write(magic, sizeof(magic));
+    write(out, uint64_t(bits.size()));
+    write(out, uint64_t(hashes));
+    out.write(reinterpret_cast<const char*>(bits.data()),
+              bits.size() * sizeof(uint64_t));
+    write(out, uint64_t(table.size()));
+    for (const auto& entry : table) {
+      write(out, uint32_t(entry.first.size()));
+      out.write(entry.first.data(), entry.first.size());
+      write(out, uint8_t(entry.second));
+    }
+    if (!out) return false;
+  }
+  return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+bool NegativeCache::load(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  char m[sizeof(magic)];
+  uint64_t words, k, entries;
+  if (!in.read(m, sizeof(m)) ||
+      std::string(m, sizeof(m)) != std::string(magic, sizeof(magic)) ||
+      !read(in, words) || !read(in, k) || words == 0)
+    return false;
+  std::vector<uint64_t> savedBits(words);
+  if (!in.read(reinterpret_cast<char*>(savedBits.data()),
+               words * sizeof(uint64_t)) ||
+      !read(in, entries))
+    return false;
+  std::unordered_map<std::string, Verdict> savedTable;
+  for (uint64_t e = 0; e < entries; e++) {
+    uint32_t length;
+    uint8_t verdict;
+    if (!read(in, length)) return false;
+    std::string key(length, '\0');
+    if (!in.read(&key[0], length) || !read(in, verdict)) return false;
+    savedTable[key] = static_cast<Verdict>(verdict);
+  }
+
+  bits.swap(savedBits);
+  hashes = k;
+  table.swap(savedTable);
+  return true;
+}
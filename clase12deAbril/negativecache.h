@@ -0,0 +1,58 @@
+#ifndef NEGATIVECACHE_H_
+#define NEGATIVECACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Remembers the puzzles proven invalid: those without a solution and those
+ * with more than one.
+ *
+ * A Bloom filter answers most lookups of valid puzzles without touching the
+ * table, and an exact table confirms its positives so that no valid puzzle is
+ * ever rejected. Puzzles are flat grids, row by row, with 0 for empty cells.
+ * The cache can be saved to a file and loaded back after a restart.
+ */
+class NegativeCache {
+public:
+  enum Verdict { Unknown, Unsolvable, NotUnique };
+
+  // Lookups, those answered by the filter alone and those confirmed by the
+  // table.
+  size_t lookups;
+  size_t filtered;
+  size_t hits;
+
+  /**
+   * A filter of the given number of bits, using that many hash functions.
+   */
+  explicit NegativeCache(size_t bits = 1 << 20, size_t hashes = 7);
+
+  Verdict lookup(const std::vector<int>& puzzle);
+  void insert(const std::vector<int>& puzzle, Verdict verdict);
+  size_t size() const { return table.size(); }
+
+  /**
+   * Writes the cache to path, replacing the file atomically.
+   */
+  bool save(const std::string& path) const;
+  /**
+   * Replaces the contents of the cache with those saved in path.
+   */
+  bool load(const std::string& path);
+
+private:
+  static std::string key(const std::vector<int>& puzzle);
+  static uint64_t hash(const std::string& key, uint64_t seed);
+  bool test(const std::string& key) const;
+  void set(const std::string& key);
+
+  std::vector<uint64_t> bits;
+  size_t hashes;
+  std::unordered_map<std::string, Verdict> table;
+};
+
+#endif  // NEGATIVECACHE_H_
@@ -0,0 +1,370 @@
+#include "sat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+const double varDecay = 0.95;
+const double clauseDecay = 0.999;
+const size_t restartBase = 100;
+
+int toInternal(int lit) {
+  return lit > 0 ? 2 * (lit - 1) : 2 * (-lit - 1) + 1;
+}
+}
+
+SatSolver::SatSolver()
+    : decisions(0)
+    , conflicts(0)
+    , propagations(0)
+    , restarts(0)
+    , ok(true)
+    , qhead(0)
+    , varInc(1)
+    , clauseInc(1)
+    , maxLearnts(0) {}
+
+SatSolver::~SatSolver() {
+  for (Clause* c : clauses) delete c;
+  for (Clause* c : learnts) delete c;
+}
+
+int SatSolver::newVar() {
+  int v = activity.size();
+  watches.push_back({});
+  watches.push_back({});
+  assigns.push_back(0);
+  polarity.push_back(1);
+  level.push_back(0);
+  reason.push_back(nullptr);
+  activity.push_back(0);
+  heapIndex.push_back(-1);
+  seen.push_back(0);
+  heapInsert(v);
+  return v + 1;
+}
+
+bool SatSolver::addClause(const std::vector<int>& external) {
+  if (!ok) return false;
+  std::vector<int> lits;
+  for (int l : external) lits.push_back(toInternal(l));
+  std::sort(lits.begin(), lits.end());
+
+  // Drop duplicated and false literals, skip the clause if it is satisfied.
+  size_t j = 0;
+  for (size_t i = 0; i < lits.size(); i++) {
+    if (value(lits[i]) == 1 || (i > 0 && lits[i] == neg(lits[i - 1])))
+      return true;
+    if (value(lits[i]) == -1 || (i > 0 && lits[i] == lits[i - 1])) continue;
+    lits[j++] = lits[i];
+  }
+  lits.resize(j);
+
+  if (lits.empty()) {
+    ok = false;
+  } else if (lits.size() == 1) {
+    enqueue(lits[0], nullptr);
+    ok = propagate() == nullptr;
+  } else {
+    Clause* c = new Clause{lits, false, 0};
+    clauses.push_back(c);
+    attach(c);
+  }
+  return ok;
+}
+
+void SatSolver::attach(Clause* c) {
+  watches[c->lits[0]].push_back(c);
+  watches[c->lits[1]].push_back(c);
+}
+
+void SatSolver::detach(Clause* c) {
+  for (size_t k = 0; k < 2; k++) {
+    auto& ws = watches[c->lits[k]];
+    ws.erase(std::find(ws.begin(), ws.end(), c));
+  }
+}
+
+bool SatSolver::locked(const Clause* c) const {
+  return value(c->lits[0]) == 1 && reason[var(c->lits[0])] == c;
+}
+
+void SatSolver::enqueue(int lit, Clause* r) {
+  assigns[var(lit)] = (lit & 1) ? -1 : 1;
+  level[var(lit)] = decisionLevel();
+  reason[var(lit)] = r;
+  trail.push_back(lit);
+}
+
+/**
+ * Unit propagation over the two watched literals of every clause. The first
+ * literal of a clause used as a reason is always the implied one. Returns the
+ * conflicting clause, or nullptr.
+ */
+SatSolver::Clause* SatSolver::propagate() {
+  while (qhead < trail.size()) {
+    int falseLit = neg(trail[qhead++]);
+    propagations++;
+    auto& ws = watches[falseLit];
+    size_t i = 0, j = 0;
+    while (i < ws.size()) {
+      Clause* c = ws[i++];
+      auto& lits = c->lits;
+      if (lits[0] == falseLit) std::swap(lits[0], lits[1]);
+      if (value(lits[0]) == 1) {
+        ws[j++] = c;
+        continue;
+      }
+
+      bool moved = false;
+      for (size_t k = 2; k < lits.size(); k++)
+        if (value(lits[k]) != -1) {
+          std::swap(lits[1], lits[k]);
+          watches[lits[1]].push_back(c);
+          moved = true;
+          break;
+        }
+      if (moved) continue;
+
+      ws[j++] = c;
+      if (value(lits[0]) == -1) {
+        while (i < ws.size()) ws[j++] = ws[i++];
+        ws.resize(j);
+        qhead = trail.size();
+        return c;
+      }
+      enqueue(lits[0], c);
+    }
+    ws.resize(j);
+  }
+  return nullptr;
+}
+
+/**
+ * First-UIP conflict analysis. Fills learnt with the asserting clause, its
+ * first literal being the one to assert, and btLevel with the level to
+ * backtrack to.
+ */
+void SatSolver::analyze(Clause* confl, std::vector<int>& learnt,
+                        size_t& btLevel) {
+  learnt.assign(1, 0);
+  size_t pathCount = 0;
+  int p = -1;
+  size_t index = trail.size();
+
+  do {
+    if (confl->learnt) bumpClause(confl);
+    for (size_t k = (p == -1 ? 0 : 1); k < confl->lits.size(); k++) {
+      int q = confl->lits[k];
+      int v = var(q);
+      if (seen[v] || level[v] == 0) continue;
+      bumpVar(v);
+      seen[v] = 1;
+      if (level[v] >= decisionLevel())
+        pathCount++;
+      else
+        learnt.push_back(q);
+    }
+    while (!seen[var(trail[--index])]) {
+    }
+    p = trail[index];
+    confl = reason[var(p)];
+    seen[var(p)] = 0;
+    pathCount--;
+  } while (pathCount > 0);
+  learnt[0] = neg(p);
+
+  btLevel = 0;
+  size_t max = 1;
+  for (size_t k = 1; k < learnt.size(); k++) {
+    seen[var(learnt[k])] = 0;
+    if (level[var(learnt[k])] > btLevel) {
+      btLevel = level[var(learnt[k])];
+      max = k;
+    }
+  }
+  if (learnt.size() > 1) std::swap(learnt[1], learnt[max]);
+}
+
+void SatSolver::cancelUntil(size_t lvl) {
+  if (decisionLevel() <= lvl) return;
+  for (size_t k = trail.size(); k > trailLim[lvl]; k--) {
+    int v = var(trail[k - 1]);
+    polarity[v] = trail[k - 1] & 1;
+    assigns[v] = 0;
+    reason[v] = nullptr;
+    heapInsert(v);
+  }
+  trail.resize(trailLim[lvl]);
+  trailLim.resize(lvl);
+  qhead = trail.size();
+}
+
+/**
+ * Deletes the less active half of the learned clauses, keeping the ones that
+ * are currently the reason of an assignment.
+ */
+void SatSolver::reduceLearnts() {
+  std::sort(learnts.begin(), learnts.end(), [](Clause* a, Clause* b) {
+    return a->activity < b->activity;
+  });
+  size_t j = 0;
+  for (size_t i = 0; i < learnts.size(); i++) {
+    Clause* c = learnts[i];
+    if (i < learnts.size() / 2 && c->lits.size() > 2 && !locked(c)) {
+      detach(c);
+      delete c;
+    } else {
+      learnts[j++] = c;
+    }
+  }
+  learnts.resize(j);
+}
+
+void SatSolver::bumpVar(int v) {
+  if ((activity[v] += varInc) > 1e100) {
+    for (double& a : activity) a *= 1e-100;
+    varInc *= 1e-100;
+  }
+  if (heapIndex[v] >= 0) heapUp(heapIndex[v]);
+}
+
+void SatSolver::bumpClause(Clause* c) {
+  if ((c->activity += clauseInc) > 1e20) {
+    for (Clause* l : learnts) l->activity *= 1e-20;
+    clauseInc *= 1e-20;
+  }
+}
+
+int SatSolver::pickBranchVar() {
+  while (!heap.empty()) {
+    int v = heapPop();
+    if (assigns[v] == 0) return v;
+  }
+  return -1;
+}
+
+void SatSolver::heapInsert(int v) {
+  if (heapIndex[v] >= 0) return;
+  heapIndex[v] = heap.size();
+  heap.push_back(v);
+  heapUp(heap.size() - 1);
+}
+
+void SatSolver::heapUp(size_t i) {
+  int v = heap[i];
+  while (i > 0 && heapLess(v, heap[(i - 1) / 2])) {
+    heap[i] = heap[(i - 1) / 2];
+    heapIndex[heap[i]] = i;
+    i = (i - 1) / 2;
+  }
+  heap[i] = v;
+  heapIndex[v] = i;
+}
+
+void SatSolver::heapDown(size_t i) {
+  int v = heap[i];
+  while (2 * i + 1 < heap.size()) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < heap.size() && heapLess(heap[child + 1], heap[child]))
+      child++;
+    if (!heapLess(heap[child], v)) break;
+    heap[i] = heap[child];
+    heapIndex[heap[i]] = i;
+    i = child;
+  }
+  heap[i] = v;
+  heapIndex[v] = i;
+}
+
+int SatSolver::heapPop() {
+  int v = heap[0];
+  heap[0] = heap.back();
+  heapIndex[heap[0]] = 0;
+  heap.pop_back();
+  heapIndex[v] = -1;
+  if (!heap.empty()) heapDown(0);
+  return v;
+}
+
+double luby(double y, size_t x) {
+  size_t size = 1, seq = 0;
+  while (size < x + 1) {
+    seq++;
+    size = 2 * size + 1;
+  }
+  while (size - 1 != x) {
+    size = (size - 1) >> 1;
+    seq--;
+    x = x % size;
+  }
+  return std::pow(y, seq);
+}
+
+SatSolver::Result SatSolver::solve() {
+  if (!ok || propagate() != nullptr) {
+    ok = false;
+    return Unsatisfiable;
+  }
+
+  maxLearnts = clauses.size() / 3.0 + 100;
+  size_t conflictsSinceRestart = 0;
+  size_t restartLimit = restartBase * luby(2, restarts);
+  std::vector<int> learnt;
+
+  while (true) {
+    Clause* confl = propagate();
+    if (confl != nullptr) {
+      conflicts++;
+      conflictsSinceRestart++;
+      if (decisionLevel() == 0) {
+        ok = false;
+        return Unsatisfiable;
+      }
+      if (terminate && terminate()) {
+        cancelUntil(0);
+        return Unknown;
+      }
+
+      size_t btLevel;
+      analyze(confl, learnt, btLevel);
+      cancelUntil(btLevel);
+      if (learnt.size() == 1) {
+        enqueue(learnt[0], nullptr);
+      } else {
+        Clause* c = new Clause{learnt, true, 0};
+        learnts.push_back(c);
+        attach(c);
+        bumpClause(c);
+        enqueue(learnt[0], c);
+      }
+      varInc /= varDecay;
+      clauseInc /= clauseDecay;
+      continue;
+    }
+
+    if (conflictsSinceRestart >= restartLimit) {
+      restarts++;
+      conflictsSinceRestart = 0;
+      restartLimit = restartBase * luby(2, restarts);
+      cancelUntil(0);
+      if (learnts.size() >= maxLearnts) {
+        reduceLearnts();
+        maxLearnts *= 1.1;
+      }
+      continue;
+    }
+
+    int v = pickBranchVar();
+    if (v == -1) {
+      model.assign(numVars(), false);
+      for (size_t k = 0; k < numVars(); k++) model[k] = assigns[k] == 1;
+      cancelUntil(0);
+      return Satisfiable;
+    }
+    decisions++;
+    trailLim.push_back(trail.size());
+    enqueue(2 * v + polarity[v], nullptr);
+  }
+}
@@ -0,0 +1,125 @@
+#ifndef SAT_H_
+#define SAT_H_
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+/**
+ * Element x (from 0) of the Luby sequence 1 1 2 1 1 2 4 1 1 2 ..., with the
+ * powers of 2 replaced by powers of y.
+ */
+double luby(double y, size_t x);
+
+/**
+ * A small self-contained CDCL SAT solver.
+ *
+ * It implements two-watched-literal unit propagation, the VSIDS decision
+ * heuristic with phase saving, first-UIP clause learning, restarts following
+ * the Luby sequence and periodic deletion of inactive learned clauses.
+ *
+ * Literals use the DIMACS convention: variables are numbered from 1, v stands
+ * for the variable being true and -v for it being false.
+ */
+class SatSolver {
+public:
+  enum Result { Satisfiable, Unsatisfiable, Unknown };
+
+  size_t decisions;
+  size_t conflicts;
+  size_t propagations;
+  size_t restarts;
+
+  SatSolver();
+  ~SatSolver();
+
+  /**
+   * Creates a new variable and returns its number.
+   */
+  int newVar();
+  size_t numVars() const { return activity.size(); }
+
+  /**
+   * Adds a clause to the problem. Returns false if the problem became
+   * trivially unsatisfiable.
+   */
+  bool addClause(const std::vector<int>& lits);
+
+  /**
+   * Polled after every conflict: when it returns true the search gives up and
+   * solve returns Unknown.
+   */
+  std::function<bool()> terminate;
+
+  /**
+   * Decides the problem. When it is satisfiable the model can be read with
+   * modelValue.
+   */
+  Result solve();
+  bool modelValue(int var) const { return model[var - 1]; }
+
+private:
+  struct Clause {
+    std::vector<int> lits;
+    bool learnt;
+    double activity;
+  };
+
+  SatSolver(const SatSolver&);
+  SatSolver& operator=(const SatSolver&);
+
+  // Internal literals are 2 * var + sign, with var numbered from 0.
+  static int var(int lit) { return lit >> 1; }
+  static int neg(int lit) { return lit ^ 1; }
+  // 1 true, -1 false, 0 unassigned.
+  int value(int lit) const {
+    int v = assigns[var(lit)];
+    return (lit & 1) ? -v : v;
+  }
+
+  void enqueue(int lit, Clause* reason);
+  Clause* propagate();
+  void analyze(Clause* confl, std::vector<int>& learnt, size_t& btLevel);
+  void cancelUntil(size_t level);
+  size_t decisionLevel() const { return trailLim.size(); }
+  void attach(Clause* c);
+  void detach(Clause* c);
+  bool locked(const Clause* c) const;
+  void reduceLearnts();
+
+  void bumpVar(int v);
+  void bumpClause(Clause* c);
+  int pickBranchVar();
+
+  // Binary max-heap of variables ordered by activity.
+  bool heapLess(int a, int b) const { return activity[a] > activity[b]; }
+  void heapInsert(int v);
+  void heapUp(size_t i);
+  void heapDown(size_t i);
+  int heapPop();
+
+  bool ok;
+  std::vector<Clause*> clauses;
+  std::vector<Clause*> learnts;
+  std::vector<std::vector<Clause*>> watches;
+
+  std::vector<int> assigns;
+  std::vector<char> polarity;
+  std::vector<size_t> level;
+  std::vector<Clause*> reason;
+  std::vector<int> trail;
+  std::vector<size_t> trailLim;
+  size_t qhead;
+
+  std::vector<double> activity;
+  double varInc;
+  double clauseInc;
+  std::vector<int> heap;
+  std::vector<int> heapIndex;
+
+  std::vector<char> seen;
+  std::vector<bool> model;
+  double maxLearnts;
+};
+
+#endif  // SAT_H_
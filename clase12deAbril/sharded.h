@@ -0,0 +1,92 @@
+#ifndef SHARDED_H_
+#define SHARDED_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <istream>
+#include <ostream>
+
+/**
+ * A counter written by one thread and read by any. Updates are a relaxed load
+ * and store, as cheap as those of a plain integer, and other threads may read
+ * the counter at any time without a data race.
+ */
+class Counter {
+public:
+  Counter(size_t v = 0)
+      : value(v) {}
+  Counter(const Counter& other)
+      : value(size_t(other)) {}
+
+  Counter& operator=(const Counter& other) { return *this = size_t(other); }
+  Counter& operator=(size_t v) {
+    value.store(v, std::memory_order_relaxed);
+    return *this;
+  }
+  operator size_t() const { return value.load(std::memory_order_relaxed); }
+
+  Counter& operator+=(size_t n) { return *this = size_t(*this) + n; }
+  Counter& operator++() { return *this += 1; }
+  size_t operator++(int) {
+    size_t old = *this;
+    *this = old + 1;
+    return old;
+  }
+
+private:
+  std::atomic<size_t> value;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const Counter& c) {
+  return out << size_t(c);
+}
+
+inline std::istream& operator>>(std::istream& in, Counter& c) {
+  size_t v;
+  if (in >> v) c = v;
+  return in;
+}
+
+/**
+ * One block of counters per thread, T, and their sum on demand.
+ *
+ * Every thread updates its own shard only, so they never wait for each other,
+ * and shards are padded so that no two of them share a cache line. snapshot
+ * adds the shards up with the += of T, and may be called while the threads
+ * run if T is made of Counters. Any default constructible T with += will do,
+ * so new counters only need a new block type.
+ */
+template <typename T>
+class Sharded {
+public:
+  explicit Sharded(size_t shards)
+      : count(shards == 0 ? 1 : shards)
+      , shards(new Shard[count]) {}
+
+  size_t size() const { return count; }
+  T& shard(size_t i) { return shards[i].block; }
+  const T& shard(size_t i) const { return shards[i].block; }
+
+  T snapshot() const {
+    T total;
+    for (size_t i = 0; i < count; i++) total += shards[i].block;
+    return total;
+  }
+
+private:
+  // The padding keeps the blocks of neighbours on different cache lines
+  // whatever the alignment of the array.
+  struct Shard {
+    T block;
+    char padding[64];
+  };
+
+  Sharded(const Sharded&);
+  Sharded& operator=(const Sharded&);
+
+  size_t count;
+  std::unique_ptr<Shard[]> shards;
+};
+
+#endif  // SHARDED_H_
@@ -0,0 +1,256 @@
+#include "solutiondb.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char magic[8] = {'S', 'U', 'D', 'O', 'K', 'U', 'D', 'B'};
+const uint32_t version = 1;
+// Slots start at this offset, after the header.
+const size_t headerSize = 64;
+// The table grows when it gets fuller than 7/10.
+const size_t maxLoad = 7;
+}
+
+struct SolutionDatabase::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t dimension;
+  uint32_t bits;
+  // Set in the old file once the writer has replaced it with a larger one.
+  uint32_t moved;
+  uint64_t capacity;
+  uint64_t count;
+};
+
+SolutionDatabase::SolutionDatabase()
+    : mode(ReadOnly)
+    , fd(-1)
+    , lockFd(-1)
+    , length(0)
+    , map(nullptr) {}
+
+SolutionDatabase::~SolutionDatabase() { close(); }
+
+bool SolutionDatabase::open(const std::string& file, Mode m, size_t dimension,
+                            size_t capacity) {
+  close();
+  path = file;
+  mode = m;
+  if (mode == ReadWrite) {
+    lockFd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lockFd < 0 || flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+      close();
+      return false;
+    }
+    if (access(path.c_str(), F_OK) != 0 &&
+        !create(path, dimension, capacity)) {
+      close();
+      return false;
+    }
+  }
+  if (!mapFile(path) || header()->dimension != dimension) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void SolutionDatabase::close() {
+  if (map != nullptr) munmap(map, length);
+  if (fd >= 0) ::close(fd);
+  if (lockFd >= 0) ::close(lockFd);
+  map = nullptr;
+  fd = lockFd = -1;
+  length = 0;
+}
+
+bool SolutionDatabase::create(const std::string& file, size_t dimension,
+                              size_t capacity) {
+  Header h = Header();
+  std::memcpy(h.magic, magic, sizeof(magic));
+  h.version = version;
+  h.dimension = dimension;
+  while ((size_t(1) << h.bits) <= dimension) h.bits++;
+  h.capacity = capacity < 8 ? 8 : capacity;
+
+  int out = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) return false;
+  size_t packed = (dimension * dimension * h.bits + 7) / 8;
+  size_t slot = (1 + 2 * packed + 2 * sizeof(uint64_t) + 7) / 8 * 8;
+  bool ok = ftruncate(out, headerSize + h.capacity * slot) == 0 &&
+            pwrite(out, &h, sizeof(h), 0) == ssize_t(sizeof(h));
+  ::close(out);
+  return ok;
+}
+
+bool SolutionDatabase::mapFile(const std::string& file) {
+  fd = ::open(file.c_str(), mode == ReadWrite ? O_RDWR : O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0 || size_t(info.st_size) < headerSize)
+    return false;
+  length = info.st_size;
+  int prot = mode == ReadWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* m = mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) return false;
+  map = static_cast<unsigned char*>(m);
+  const Header* h = header();
+  return std::memcmp(h->magic, magic, sizeof(magic)) == 0 &&
+         h->version == version &&
+         length >= headerSize + h->capacity * slotSize();
+}
+
+SolutionDatabase::Header* SolutionDatabase::header() const {
+  return reinterpret_cast<Header*>(map);
+}
+
+size_t SolutionDatabase::packedSize() const {
+  size_t N = header()->dimension;
+  return (N * N * header()->bits + 7) / 8;
+}
+
+// A slot is a used flag, the packed puzzle, the packed solution and the
+// decisions and failures of the search, padded to 8 bytes.
+size_t SolutionDatabase::slotSize() const {
+  return (1 + 2 * packedSize() + 2 * sizeof(uint64_t) + 7) / 8 * 8;
+}
+
+unsigned char* SolutionDatabase::slot(size_t i) const {
+  return map + headerSize + i * slotSize();
+}
+
+size_t SolutionDatabase::size() const {
+  return __atomic_load_n(&header()->count, __ATOMIC_ACQUIRE);
+}
+
+size_t SolutionDatabase::capacity() const { return header()->capacity; }
+
+void SolutionDatabase::pack(const std::vector<int>& grid,
+                            unsigned char* out) const {
+  size_t bits = header()->bits;
+  std::memset(out, 0, packedSize());
+  for (size_t c = 0; c < grid.size(); c++)
+    for (size_t b = 0; b < bits; b++)
+      if (grid[c] >> b & 1)
+        out[(c * bits + b) / 8] |= 1 << ((c * bits + b) % 8);
+}
+
+std::vector<int> SolutionDatabase::unpack(const unsigned char* in) const {
+  size_t N = header()->dimension, bits = header()->bits;
+  std::vector<int> grid(N * N, 0);
+  for (size_t c = 0; c < grid.size(); c++)
+    for (size_t b = 0; b < bits; b++)
+      if (in[(c * bits + b) / 8] >> ((c * bits + b) % 8) & 1)
+        grid[c] |= 1 << b;
+  return grid;
+}
+
+size_t SolutionDatabase::probe(const unsigned char* key) const {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t k = 0; k < packedSize(); k++) {
+    hash ^= key[k];
+    hash *= 1099511628211ULL;
+  }
+  size_t cap = capacity();
+  for (size_t i = hash % cap;; i = (i + 1) % cap) {
+    const unsigned char* s = slot(i);
+    if (__atomic_load_n(s, __ATOMIC_ACQUIRE) == 0 ||
+        std::memcmp(s + 1, key, packedSize()) == 0)
+      return i;
+  }
+}
+
+bool SolutionDatabase::find(const std::vector<int>& puzzle, Record& record) {
+  if (map == nullptr) return false;
+  if (__atomic_load_n(&header()->moved, __ATOMIC_ACQUIRE)) {
+    // The writer grew the table: follow it to the new file.
+    munmap(map, length);
+    ::close(fd);
+    map = nullptr;
+    if (!mapFile(path)) {
+      close();
+      return false;
+    }
+  }
+  std::vector<unsigned char> key(packedSize());
+  pack(puzzle, key.data());
+  const unsigned char* s = slot(probe(key.data()));
+  if (__atomic_load_n(s, __ATOMIC_ACQUIRE) == 0) return false;
+  record.solution = unpack(s + 1 + packedSize());
+  std::memcpy(&record.decisions, s + 1 + 2 * packedSize(), sizeof(uint64_t));
+  std::memcpy(&record.failures, s + 1 + 2 * packedSize() + sizeof(uint64_t),
+              sizeof(uint64_t));
+  return true;
+}
+
+bool SolutionDatabase::insert(const std::vector<int>& puzzle,
+                              const Record& record) {
+  if (map == nullptr || mode != ReadWrite) return false;
+  if ((size() + 1) * 10 > capacity() * maxLoad && !grow()) return false;
+  std::vector<unsigned char> key(packedSize());
+  pack(puzzle, key.data());
+  unsigned char* s = slot(probe(key.data()));
+  if (s[0] != 0) return false;
+
+  std::memcpy(s + 1, key.data(), packedSize());
+  pack(record.solution, s + 1 + packedSize());
+  std::memcpy(s + 1 + 2 * packedSize(), &record.decisions, sizeof(uint64_t));
+  std::memcpy(s + 1 + 2 * packedSize() + sizeof(uint64_t), &record.failures,
+              sizeof(uint64_t));
+  // Publish the entry only once it is complete.
+  __atomic_store_n(s, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&header()->count, header()->count + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/**
+ * Rebuilds the table with twice the capacity in a new file and renames it
+ * over the current one. Readers still have the old file mapped: it stays valid
+ * until they move to the new one.
+ */
+bool SolutionDatabase::grow() {
+  std::string tmp = path + ".tmp";
+  if (!create(tmp, header()->dimension, 2 * capacity())) return false;
+  unsigned char* oldMap = map;
+  size_t oldLength = length, oldSlot = slotSize(), oldCapacity = capacity();
+  int oldFd = fd;
+  if (!mapFile(tmp)) {
+    if (map != oldMap && map != nullptr) munmap(map, length);
+    if (fd >= 0) ::close(fd);
+    map = oldMap;
+    length = oldLength;
+    fd = oldFd;
+    return false;
+  }
+
+  for (size_t i = 0; i < oldCapacity; i++) {
+    const unsigned char* from = oldMap + headerSize + i * oldSlot;
+    if (from[0] == 0) continue;
+    std::memcpy(slot(probe(from + 1)), from, oldSlot);
+    header()->count++;
+  }
+  msync(map, length, MS_SYNC);
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    munmap(map, length);
+    ::close(fd);
+    map = oldMap;
+    length = oldLength;
+    fd = oldFd;
+    return false;
+  }
+  __atomic_store_n(&reinterpret_cast<Header*>(oldMap)->moved, 1,
+                   __ATOMIC_RELEASE);
+  munmap(oldMap, oldLength);
+  ::close(oldFd);
+  return true;
+}
+
+void SolutionDatabase::flush() {
+  if (map != nullptr && mode == ReadWrite) msync(map, length, MS_SYNC);
+}
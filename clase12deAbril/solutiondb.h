@@ -0,0 +1,91 @@
+#ifndef SOLUTIONDB_H_
+#define SOLUTIONDB_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * A persistent hash table of solved puzzles, kept in a file and accessed
+ * through mmap.
+ *
+ * Puzzles and solutions are flat grids, row by row, with 0 for empty cells.
+ * They are packed with just enough bits per cell for the dimension of the
+ * database. Each entry also records the work the search took.
+ *
+ * The table uses open addressing with linear probing and never deletes, so
+ * readers need no locks. Any number of processes may open the file read-only
+ * while a single writer, enforced with a lock file, appends to it. An entry
+ * is written first and only then marked as used, so readers never see half of
+ * it. When the table gets too full the writer rebuilds it twice as large in a
+ * new file, renames it over the old one and flags the old one as moved.
+ * Readers notice the flag and open the new file.
+ */
+class SolutionDatabase {
+public:
+  enum Mode { ReadOnly, ReadWrite };
+
+  struct Record {
+    std::vector<int> solution;
+    uint64_t decisions;
+    uint64_t failures;
+  };
+
+  SolutionDatabase();
+  ~SolutionDatabase();
+
+  /**
+   * Opens the database in path. In ReadWrite mode the file is created, with
+   * room for capacity entries, if it does not exist. Fails if the file is not
+   * a database of that dimension, or another writer has it open.
+   */
+  bool open(const std::string& path, Mode mode, size_t dimension = 9,
+            size_t capacity = 1 << 16);
+  void close();
+  bool isOpen() const { return map != nullptr; }
+
+  bool find(const std::vector<int>& puzzle, Record& record);
+
+  /**
+   * Adds a puzzle and its solution. Returns false in read-only mode, and if
+   * the puzzle was already there.
+   */
+  bool insert(const std::vector<int>& puzzle, const Record& record);
+
+  size_t size() const;
+  size_t capacity() const;
+
+  /**
+   * Writes the changes to disk.
+   */
+  void flush();
+
+private:
+  struct Header;
+
+  SolutionDatabase(const SolutionDatabase&);
+  SolutionDatabase& operator=(const SolutionDatabase&);
+
+  bool create(const std::string& file, size_t dimension, size_t capacity);
+  bool mapFile(const std::string& file);
+  bool grow();
+
+  Header* header() const;
+  unsigned char* slot(size_t i) const;
+  size_t slotSize() const;
+  size_t packedSize() const;
+  void pack(const std::vector<int>& grid, unsigned char* out) const;
+  std::vector<int> unpack(const unsigned char* in) const;
+  // Slot holding the puzzle, or the empty slot where it would go.
+  size_t probe(const unsigned char* key) const;
+
+  std::string path;
+  Mode mode;
+  int fd;
+  int lockFd;
+  size_t length;
+  unsigned char* map;
+};
+
+#endif  // SOLUTIONDB_H_
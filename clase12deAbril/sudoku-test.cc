@@ -2,6 +2,7 @@
 #include <vector>
 #include <iostream>
 #include <utility>
+#include <chrono>
 #include "format.h"
 
 using std::vector;
@@ -35,6 +36,7 @@ public:
 
   Sudoku(const Sudoku& other)
       : board(other.board) {}
+  Sudoku& operator=(const Sudoku& other) = default;
 
   bool isSolved() const {
     for (size_t i = 0; i < 9; i++)
@@ -56,6 +58,21 @@ public:
 
   void tryValue(Coordinate c, int v) { board[c.first][c.second] = v; }
 
+  size_t filledCells() const {
+    size_t filled = 0;
+    for (const auto& row : board)
+      for (int cell : row)
+        if (cell != 0) filled++;
+    return filled;
+  }
+
+  bool isConsistent() const {
+    for (size_t i = 0; i < 9; i++)
+      for (size_t j = 0; j < 9; j++)
+        if (board[i][j] != 0 && !check(i, j)) return false;
+    return true;
+  }
+
 private:
   bool checkRow(size_t i, size_t j) const {
     for (size_t x = 0; x < 9; x++) {
@@ -132,37 +149,104 @@ struct Statistics {
   }
 };
 
-pair<Sudoku, bool> solveOne(Sudoku& s, Statistics& st) {
+enum class Status { Solved, Unsolvable, OutOfBudget };
+
+/**
+ * Limits the number of nodes and the time a search may take. Zero means no
+ * limit. Keeps the most filled consistent board seen as the partial result,
+ * unless there is no limit and so no partial result to give. The clock is
+ * only read every few calls.
+ */
+class Budget {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  Budget(size_t nodes = 0, double seconds = 0)
+      : maxNodes(nodes)
+      , seconds(seconds)
+      , start(Clock::now())
+      , calls(0)
+      , stopped(false)
+      , bestFilled(0) {}
+
+  bool exhausted(const Statistics& st) {
+    if (stopped) return true;
+    if (maxNodes > 0 && st.decisions >= maxNodes) stopped = true;
+    if (seconds > 0 && calls++ % 16 == 0 &&
+        std::chrono::duration<double>(Clock::now() - start).count() >= seconds)
+      stopped = true;
+    return stopped;
+  }
+
+  bool out() const { return stopped; }
+
+  /**
+   * Offers s, which has filled cells that are not empty.
+   */
+  void offer(const Sudoku& s, size_t filled) {
+    if (maxNodes == 0 && seconds == 0) return;
+    if (filled > bestFilled && s.isConsistent()) {
+      bestFilled = filled;
+      partial = s;
+    }
+  }
+  const Sudoku& best() const { return partial; }
+
+private:
+  size_t maxNodes;
+  double seconds;
+  Clock::time_point start;
+  size_t calls;
+  bool stopped;
+  size_t bestFilled;
+  Sudoku partial;
+};
+
+pair<Sudoku, bool> solveOne(Sudoku& s, Statistics& st, Budget& b,
+                            size_t filled) {
+  if (b.exhausted(st)) return {s, false};
   auto result = s.nextToSolve();
   bool done = result.first;
   if (done) {
     if (s.isSolved())
       return {s, true};
-    else
+    else {
+      st.failures++;
       return {s, false};
+    }
   } else {
+    b.offer(s, filled);
     Coordinate c = result.second;
     for (int i = 1; i <= 9; i++) {
       Sudoku copy(s);
       copy.tryValue(c,i);
-      auto r = solveOne(copy,st);
-      if (r.second) return r;
+      st.decisions++;
+      auto r = solveOne(copy,st,b,filled + 1);
+      if (r.second || b.out()) return r;
     }
     // No solution found
     return {s,false};
   }
 }
 
-void solve(const Sudoku& s) {
+Status solve(const Sudoku& s, Budget b = Budget()) {
   Statistics st;
   Sudoku root(s);
-  pair<Sudoku, bool> sol = solveOne(root, st);
+  pair<Sudoku, bool> sol = solveOne(root, st, b, root.filledCells());
+  Status status = Status::Unsolvable;
   if (sol.second) {
+    status = Status::Solved;
+    st.solutions++;
     sol.first.print();
+  } else if (b.out()) {
+    status = Status::OutOfBudget;
+    print("Budget exhausted, most filled board:\n");
+    b.best().print();
   } else {
     print("No solution found\n");
   }
   st.print();
+  return status;
 }
 
 int main(void) {
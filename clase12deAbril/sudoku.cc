@@ -1,8 +1,33 @@
 #include <set>
+#include <bitset>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <utility>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <functional>
+#include <memory>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <list>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 #include "format.h"
+#include "sat.h"
+#include "solutiondb.h"
+#include "negativecache.h"
+#include "threadpool.h"
+#include "boundedqueue.h"
+#include "sharded.h"
+#include "bitsliced.h"
+#include "topology.h"
 
 using std::set;
 using std::vector;
@@ -11,15 +36,39 @@ using fmt::print;
 
 using Coordinate = pair<size_t, size_t>;
 
+/**
+ * Search engine used by the solver entry points.
+ */
+enum class Engine { Backtracking, Backjumping, Sat, LocalSearch, BitSliced };
+
+/**
+ * Strength of the propagation done by Sudoku::reduce. Each level adds to the
+ * previous one. Auto is only meaningful for the solvers: it starts with naked
+ * singles and escalates when the search grows too big.
+ */
+enum class PropagationLevel {
+  None,
+  NakedSingles,
+  HiddenSingles,
+  Subsets,
+  Probing,
+  Auto
+};
+
 class Sudoku {
-private:
+public:
   using Cell = set<int>;
+
+private:
   using Board = vector<vector<Cell>>;
 
   Board board;
+  // Side of the boxes: the board has n * n rows, columns and values.
+  size_t n;
 
 public:
-  Sudoku() {
+  Sudoku()
+      : n(3) {
     Cell all{1, 2, 3, 4, 5, 6, 7, 8, 9};
     board = {
         {all, all, all, all, all, all, all, all, all},
@@ -34,8 +83,16 @@ public:
     };
   }
 
-  Sudoku(const vector<vector<int>>& s) {
-    Cell all{1, 2, 3, 4, 5, 6, 7, 8, 9};
+  /**
+   * Builds a board from its values, 0 standing for an empty cell. Any
+   * n^2 x n^2 board is accepted, the classic one being 9x9.
+   */
+  Sudoku(const vector<vector<int>>& s)
+      : n(0) {
+    while ((n + 1) * (n + 1) <= s.size()) n++;
+    assert(n * n == s.size());
+    Cell all;
+    for (int v = 1; v <= int(s.size()); v++) all.insert(v);
     for (const auto& row : s) {
       board.push_back(vector<Cell>());
       for (const auto& v : row) {
@@ -48,7 +105,15 @@ public:
   }
 
   Sudoku(const Sudoku& other)
-      : board(other.board) {}
+      : board(other.board)
+      , n(other.n) {}
+  Sudoku& operator=(const Sudoku& other) = default;
+
+  /**
+   * Number of rows (and columns, and values) of the board.
+   */
+  size_t dimension() const { return board.size(); }
+  size_t boxSize() const { return n; }
 
   bool isSolved() const {
     for (const auto& row : board)
@@ -66,38 +131,95 @@ public:
 
   bool solvedCell(size_t i, size_t j) const { return board[i][j].size() == 1; }
 
+  /**
+   * Total number of candidates left on the board: the lower, the more
+   * propagated the board is.
+   */
+  size_t candidateCount() const {
+    size_t count = 0;
+    for (const auto& row : board)
+      for (const auto& cell : row) count += cell.size();
+    return count;
+  }
+
+  /**
+   * The values of the board row by row, 0 for the cells not solved.
+   */
+  vector<int> grid() const {
+    size_t N = dimension();
+    vector<int> g(N * N, 0);
+    for (size_t i = 0; i < N; i++)
+      for (size_t j = 0; j < N; j++)
+        if (solvedCell(i, j)) g[i * N + j] = valueCell(i, j);
+    return g;
+  }
+
+  static Sudoku fromGrid(const vector<int>& g) {
+    size_t N = 0;
+    while (N * N < g.size()) N++;
+    vector<vector<int>> values(N, vector<int>(N));
+    for (size_t c = 0; c < g.size(); c++) values[c / N][c % N] = g[c];
+    return Sudoku(values);
+  }
+
+  /**
+   * Whether the board is made of clues only: every cell is either solved or
+   * has all its candidates.
+   */
+  bool isClueBoard() const {
+    for (const auto& row : board)
+      for (const auto& cell : row)
+        if (cell.size() != 1 && cell.size() != dimension()) return false;
+    return true;
+  }
+
   int valueCell(size_t i, size_t j) const {
     assert(solvedCell(i, j));
     return *(board[i][j].begin());
   }
 
-  void reduce() {
+  /**
+   * Propagates the constraints until a fixpoint is reached. Every level
+   * includes the reductions of the levels below it.
+   *
+   * With a team, naked and hidden singles are split among its threads on
+   * boards of at least parallelDimension rows. Smaller boards are propagated
+   * serially. The boards reduce leaves do not depend on the size of the team.
+   */
+  void reduce(PropagationLevel level = PropagationLevel::NakedSingles,
+              ThreadTeam* team = nullptr) {
+    if (level == PropagationLevel::None) {
+      reduceConflicts();
+      return;
+    }
+    if (dimension() < parallelDimension) team = nullptr;
     bool r = true;
-    while (r) {
-      r = false;
-      for (size_t x = 0; x < 9; x++)
-        for (size_t y = 0; y < 9; y++) {
-          r = r || reduceRow(x, y);
-          r = r || reduceCol(x, y);
-          r = r || reduceBox(x, y);
-        }
-      // fmt::print_colored(fmt::YELLOW, "Finished pass\n");
+    while (r && !isFailed()) {
+      r = reduceNakedSingles(team);
+      if (r || isFailed()) continue;
+      if (level >= PropagationLevel::HiddenSingles)
+        r = team != nullptr ? reduceHiddenSingles(*team)
+                            : reduceHiddenSingles();
+      if (r || isFailed()) continue;
+      if (level >= PropagationLevel::Subsets) r = reduceSubsets();
+      if (r || isFailed()) continue;
+      if (level >= PropagationLevel::Probing) r = probe(team);
     }
   }
 
   Coordinate nextCellTosolve() const {
-    for (size_t x = 0; x < 9; x++)
-      for (size_t y = 0; y < 9; y++)
+    for (size_t x = 0; x < dimension(); x++)
+      for (size_t y = 0; y < dimension(); y++)
         if (!solvedCell(x, y)) return {x, y};
     assert(false);
     return {0, 0};
   }
 
   Coordinate smarterNextCellTosolve() const {
-    size_t minCard = 9;
+    size_t minCard = dimension() + 1;
     Coordinate result{0, 0};
-    for (size_t x = 0; x < 9; x++)
-      for (size_t y = 0; y < 9; y++) {
+    for (size_t x = 0; x < dimension(); x++)
+      for (size_t y = 0; y < dimension(); y++) {
         if (!solvedCell(x, y) && board[x][y].size() < minCard) {
           minCard = board[x][y].size();
           result = {x, y};
@@ -106,10 +228,37 @@ public:
     return result;
   }
 
+  /**
+   * Same as smarterNextCellTosolve, but the ties between the cells with the
+   * fewest candidates are broken at random.
+   */
+  Coordinate smarterNextCellTosolve(std::mt19937& rng) const {
+    size_t minCard = dimension() + 1;
+    size_t ties = 0;
+    Coordinate result{0, 0};
+    for (size_t x = 0; x < dimension(); x++)
+      for (size_t y = 0; y < dimension(); y++) {
+        if (solvedCell(x, y) || board[x][y].size() > minCard) continue;
+        if (board[x][y].size() < minCard) {
+          minCard = board[x][y].size();
+          ties = 0;
+        }
+        // Reservoir sampling: keep each of the ties with equal probability.
+        if (rng() % ++ties == 0) result = {x, y};
+      }
+    return result;
+  }
+
   int possibleValueForCell(const Coordinate& c) const {
     return *(board[c.first][c.second].begin());
   }
 
+  int possibleValueForCell(const Coordinate& c, std::mt19937& rng) const {
+    auto it = board[c.first][c.second].begin();
+    std::advance(it, rng() % board[c.first][c.second].size());
+    return *it;
+  }
+
   void removeValueForCell(const Coordinate& c, int v) {
     board[c.first][c.second].erase(v);
   }
@@ -118,13 +267,241 @@ public:
     board[c.first][c.second] = {v};
   }
 
+  const Cell& cellAt(const Coordinate& c) const {
+    return board[c.first][c.second];
+  }
+
+  /**
+   * The units (rows, columns and boxes) of the board.
+   */
+  const vector<vector<Coordinate>>& units() const { return unitsFor(n); }
+
+  /**
+   * The units of the boards with boxes of side n, for n up to 8 (64x64).
+   */
+  static const vector<vector<Coordinate>>& unitsFor(size_t n) {
+    static const vector<vector<vector<Coordinate>>> all = [] {
+      vector<vector<vector<Coordinate>>> tables(9);
+      for (size_t n = 1; n < tables.size(); n++)
+        for (size_t i = 0; i < n * n; i++) {
+          vector<Coordinate> row, col, box;
+          for (size_t j = 0; j < n * n; j++) {
+            row.push_back({i, j});
+            col.push_back({j, i});
+            box.push_back({n * (i / n) + j / n, n * (i % n) + j % n});
+          }
+          tables[n].push_back(row);
+          tables[n].push_back(col);
+          tables[n].push_back(box);
+        }
+      return tables;
+    }();
+    assert(n < all.size());
+    return all[n];
+  }
+
 private:
+  // Smaller boards are not worth splitting among threads.
+  enum { parallelDimension = 36 };
+
+  /**
+   * Level None does not eliminate anything, it only empties the solved cells
+   * that clash with a solved peer so that the search notices the failure.
+   */
+  void reduceConflicts() {
+    for (size_t x = 0; x < dimension(); x++)
+      for (size_t y = 0; y < dimension(); y++)
+        if (solvedCell(x, y) &&
+            (reduceRow(x, y) || reduceCol(x, y) || reduceBox(x, y)))
+          board[x][y].clear();
+  }
+
+  /**
+   * Assigns a value to a cell when it is the only place left for that value in
+   * one of its units. Returns true if the board changed.
+   */
+  bool reduceHiddenSingles() {
+    bool changed = false;
+    for (const auto& unit : units())
+      for (int v = 1; v <= int(dimension()); v++) {
+        size_t count = 0;
+        Coordinate place{0, 0};
+        for (const auto& c : unit)
+          if (board[c.first][c.second].count(v)) {
+            count++;
+            place = c;
+          }
+        if (count == 0) {
+          // The value does not fit anywhere in the unit: mark the failure.
+          board[unit[0].first][unit[0].second].clear();
+          return true;
+        }
+        if (count == 1 && !solvedCell(place.first, place.second)) {
+          assignValueForCell(place, v);
+          changed = true;
+        }
+      }
+    return changed;
+  }
+
+  /**
+   * Removes the values of the solved cells from their peers until nothing
+   * changes, in rounds. First every unit counts the values of its solved
+   * cells, then every row drops from its cells the values solved elsewhere in
+   * their units. With a team both steps are split among its threads; each
+   * step only writes what its own slice owns, so a round gives the same board
+   * whatever the threads. Returns true if the board changed.
+   */
+  bool reduceNakedSingles(ThreadTeam* team) {
+    const auto& all = units();
+    size_t N = dimension();
+    vector<size_t> solved(all.size() * (N + 1));
+    vector<char> rowChanged(N);
+    auto split = [team](size_t count, const ThreadTeam::Body& body) {
+      if (team != nullptr)
+        team->run(count, body);
+      else
+        body(0, count);
+    };
+    bool changed = false;
+    while (true) {
+      split(all.size(), [&](size_t begin, size_t end) {
+        for (size_t u = begin; u < end; u++) {
+          size_t* count = &solved[u * (N + 1)];
+          std::fill(count, count + N + 1, 0);
+          for (const auto& c : all[u])
+            if (solvedCell(c.first, c.second))
+              count[valueCell(c.first, c.second)]++;
+        }
+      });
+      split(N, [&](size_t begin, size_t end) {
+        for (size_t x = begin; x < end; x++) {
+          rowChanged[x] = false;
+          for (size_t y = 0; y < N; y++) {
+            Cell& cell = board[x][y];
+            // A solved cell does not count against itself. Units come in
+            // rows, columns and boxes order, see unitsFor.
+            int own = cell.size() == 1 ? *cell.begin() : 0;
+            size_t in[] = {3 * x, 3 * y + 1, 3 * (n * (x / n) + y / n) + 2};
+            for (auto it = cell.begin(); it != cell.end();) {
+              bool taken = false;
+              for (size_t u : in)
+                taken = taken || solved[u * (N + 1) + *it] > size_t(*it == own);
+              if (taken) {
+                it = cell.erase(it);
+                rowChanged[x] = true;
+              } else {
+                ++it;
+              }
+            }
+          }
+        }
+      });
+      if (std::find(rowChanged.begin(), rowChanged.end(), true) ==
+          rowChanged.end())
+        return changed;
+      changed = true;
+    }
+  }
+
+  /**
+   * reduceHiddenSingles with the units split among a team. They look for
+   * hidden singles on the board as it is, and what they find is applied
+   * afterwards in the order of the units.
+   */
+  bool reduceHiddenSingles(ThreadTeam& team) {
+    const auto& all = units();
+    size_t N = dimension();
+    vector<vector<pair<Coordinate, int>>> found(all.size());
+    // Units with a value that fits nowhere.
+    vector<char> failed(all.size());
+    team.run(all.size(), [&](size_t begin, size_t end) {
+      vector<size_t> count(N + 1);
+      vector<Coordinate> place(N + 1);
+      for (size_t u = begin; u < end; u++) {
+        std::fill(count.begin(), count.end(), 0);
+        for (const auto& c : all[u])
+          for (int v : cellAt(c)) {
+            count[v]++;
+            place[v] = c;
+          }
+        failed[u] = false;
+        for (int v = 1; v <= int(N); v++) {
+          const Coordinate& c = place[v];
+          if (count[v] == 0)
+            failed[u] = true;
+          else if (count[v] == 1 && !solvedCell(c.first, c.second))
+            found[u].push_back({c, v});
+        }
+      }
+    });
+
+    bool changed = false;
+    for (size_t u = 0; u < all.size(); u++) {
+      if (failed[u]) {
+        board[all[u][0].first][all[u][0].second].clear();
+        return true;
+      }
+      for (const auto& f : found[u])
+        if (!solvedCell(f.first.first, f.first.second)) {
+          assignValueForCell(f.first, f.second);
+          changed = true;
+        }
+    }
+    return changed;
+  }
+
+  /**
+   * Naked pairs and triples: when k cells of a unit have only k candidates
+   * between them, those values are removed from the rest of the unit. Returns
+   * true if the board changed.
+   */
+  bool reduceSubsets() {
+    bool changed = false;
+    for (const auto& unit : units()) {
+      vector<Coordinate> open;
+      for (const auto& c : unit) {
+        auto size = board[c.first][c.second].size();
+        if (size >= 2 && size <= 3) open.push_back(c);
+      }
+      for (size_t a = 0; a < open.size(); a++)
+        for (size_t b = a + 1; b < open.size(); b++) {
+          Cell pair(cellAt(open[a]));
+          pair.insert(cellAt(open[b]).begin(), cellAt(open[b]).end());
+          if (pair.size() == 2)
+            changed = eliminate(unit, {open[a], open[b]}, pair) || changed;
+          for (size_t c = b + 1; c < open.size(); c++) {
+            Cell triple(pair);
+            triple.insert(cellAt(open[c]).begin(), cellAt(open[c]).end());
+            if (triple.size() == 3)
+              changed = eliminate(unit, {open[a], open[b], open[c]}, triple) ||
+                        changed;
+          }
+        }
+    }
+    return changed;
+  }
+
+  /**
+   * Removes values from every cell of the unit except the ones in subset.
+   */
+  bool eliminate(const vector<Coordinate>& unit,
+                 const vector<Coordinate>& subset, const Cell& values) {
+    bool changed = false;
+    for (const auto& c : unit) {
+      if (std::find(subset.begin(), subset.end(), c) != subset.end()) continue;
+      for (int v : values)
+        if (board[c.first][c.second].erase(v)) changed = true;
+    }
+    return changed;
+  }
+
   /**
    * Reduces the cell (i,j) using the row property.
    */
   bool reduceRow(size_t i, size_t j) {
     auto oldSize = board[i][j].size();
-    for (size_t x = 0; x < 9; x++) {
+    for (size_t x = 0; x < dimension(); x++) {
       if (x != j && solvedCell(i, x)) {
         // fmt::print_colored(fmt::BLUE, "using {} {} to reduce {} {}\n", i, x,
         // i,j);
@@ -146,7 +523,7 @@ private:
   bool reduceCol(size_t i, size_t j) {
     // fmt::print_colored(fmt::RED, "Reducing cell ({},{})\n", i, j);
     auto oldSize = board[i][j].size();
-    for (size_t row = 0; row < 9; row++) {
+    for (size_t row = 0; row < dimension(); row++) {
       if (row != i && solvedCell(row, j)) {
         board[i][j].erase(valueCell(row, j));
         // fmt::print("I will use {} {}\n", row, j);
@@ -164,11 +541,11 @@ private:
   bool reduceBox(size_t i, size_t j) {
     auto oldSize = board[i][j].size();
 
-    size_t boxStartRow = i - (i % 3);
-    size_t boxStartCol = j - (j % 3);
+    size_t boxStartRow = i - (i % n);
+    size_t boxStartCol = j - (j % n);
 
-    for (size_t row = 0; row < 3; row++)
-      for (size_t col = 0; col < 3; col++) {
+    for (size_t row = 0; row < n; row++)
+      for (size_t col = 0; col < n; col++) {
         size_t x = row + boxStartRow;
         size_t y = col + boxStartCol;
         if (!(x == i && y == j) && solvedCell(x, y)) {
@@ -184,20 +561,76 @@ private:
     return false;
   }
 
+  /**
+   * Failed-literal probing. Every candidate of the cells with two or three
+   * candidates is tentatively assigned and propagated on a copy of the board.
+   * Candidates leading to a contradiction are removed, and so is any value
+   * that all the surviving branches of a cell eliminate from some other cell.
+   * Returns true if the board changed. The trials are propagated with team.
+   */
+  bool probe(ThreadTeam* team) {
+    bool changed = false;
+    for (size_t x = 0; x < dimension(); x++)
+      for (size_t y = 0; y < dimension(); y++) {
+        auto size = board[x][y].size();
+        if (size < 2 || size > 3) continue;
+
+        // reach holds, for every cell, the union of the values that survive
+        // in at least one of the consistent branches.
+        Board reach;
+        bool consistent = false;
+        Cell candidates(board[x][y]);
+        for (int v : candidates) {
+          Sudoku trial(*this);
+          trial.assignValueForCell({x, y}, v);
+          trial.reduce(PropagationLevel::Subsets, team);
+          if (trial.isFailed()) {
+            board[x][y].erase(v);
+            changed = true;
+          } else if (!consistent) {
+            reach = trial.board;
+            consistent = true;
+          } else {
+            for (size_t i = 0; i < dimension(); i++)
+              for (size_t j = 0; j < dimension(); j++)
+                reach[i][j].insert(trial.board[i][j].begin(),
+                                   trial.board[i][j].end());
+          }
+        }
+        // All the candidates failed: the board is a contradiction.
+        if (!consistent) return true;
+
+        for (size_t i = 0; i < dimension(); i++)
+          for (size_t j = 0; j < dimension(); j++) {
+            auto oldSize = board[i][j].size();
+            Cell kept;
+            for (int v : board[i][j])
+              if (reach[i][j].count(v)) kept.insert(v);
+            board[i][j].swap(kept);
+            if (board[i][j].size() < oldSize) changed = true;
+          }
+      }
+    return changed;
+  }
+
 public:
   void print() const {
+    // Boards larger than 9x9 have multi-digit values: pad and separate them.
+    size_t width = dimension() > 9 ? fmt::format("{}", dimension()).size() : 0;
+    std::string line(dimension() * (width == 0 ? 1 : width + 1) + n + 1, '-');
     fmt::print("Sudoku\n");
     size_t i = 0;
     for (const auto& row : board) {
       size_t j = 0;
-      if (i % 3 == 0) fmt::print("{:-^13}\n", "");
+      if (i % n == 0) fmt::print("{}\n", line);
       for (const auto& cell : row) {
-        if (j % 3 == 0) fmt::print("|");
+        if (j % n == 0) fmt::print("|");
 
         if (cell.size() == 0) {
           fmt::print_colored(fmt::RED, "{{}}");
         } else if (cell.size() == 1) {
-          auto elem = *(cell.cbegin());
+          auto elem = fmt::format("{}", *(cell.cbegin()));
+          if (width > 0) elem.insert(0, width + 1 - elem.size(), ' ');
           fmt::print_colored(fmt::GREEN, "{}", elem);
         } else {
           fmt::print("{{");
@@ -209,37 +642,671 @@ public:
       fmt::print("|\n");
       i++;
     }
-    fmt::print("{:-^13}\n", "");
+    fmt::print("{}\n", line);
   }
 };
 
 struct Statistics {
-  size_t solutions;
-  size_t failures;
-  size_t decisions;
-  size_t reductions;
+  Counter solutions;
+  Counter failures;
+  Counter decisions;
+  Counter reductions;
+  Counter backjumps;
+  Counter nogoods;
+  Counter restarts;
+  // Probes and hits of the transposition table.
+  Counter lookups;
+  Counter hits;
 
   Statistics()
       : solutions(0)
       , failures(0)
       , decisions(0)
-      , reductions(0) {}
+      , reductions(0)
+      , backjumps(0)
+      , nogoods(0)
+      , restarts(0)
+      , lookups(0)
+      , hits(0) {}
+
+  Statistics& operator+=(const Statistics& other) {
+    solutions += other.solutions;
+    failures += other.failures;
+    decisions += other.decisions;
+    reductions += other.reductions;
+    backjumps += other.backjumps;
+    nogoods += other.nogoods;
+    restarts += other.restarts;
+    lookups += other.lookups;
+    hits += other.hits;
+    return *this;
+  }
   void print() const {
     fmt::print_colored(
         fmt::GREEN,
         "Solutions: {}\t Failures: {}\t Decisions: {}\t Reductions: {}\n",
         solutions, failures, decisions, reductions);
+    if (backjumps > 0 || nogoods > 0 || restarts > 0)
+      fmt::print_colored(fmt::GREEN,
+                         "Backjumps: {}\t Nogoods: {}\t Restarts: {}\n",
+                         backjumps, nogoods, restarts);
+    if (lookups > 0)
+      fmt::print_colored(fmt::GREEN, "Table hits: {} of {} ({:.1f}%)\n", hits,
+                         lookups, 100.0 * hits / lookups);
+  }
+};
+
+/**
+ * Outcome of a search.
+ */
+enum class Status {
+  // The search found a solution (and, when enumerating, ran to completion).
+  Solved,
+  // The search ran to completion without finding any solution.
+  Unsolvable,
+  // The visitor stopped the enumeration, or a count reached its limit.
+  Stopped,
+  // A limit of the budget was reached first.
+  OutOfBudget
+};
+
+/**
+ * Node and reduction limits shared by searches that run together, so that
+ * the fastest of them may use what the others leave. Each search adds what it
+ * spends to the counters, and all of them stop once one is reached.
+ */
+class SharedLimits {
+public:
+  SharedLimits(size_t nodes, size_t reductions)
+      : maxNodes(nodes)
+      , maxReductions(reductions)
+      , nodes(0)
+      , reductions(0) {}
+
+  /**
+   * Adds decisions and reductions spent by one of the searches and returns
+   * true once a limit has been reached.
+   */
+  bool spend(size_t decisions, size_t reduced) {
+    size_t n = decisions > 0
+                   ? nodes.fetch_add(decisions, std::memory_order_relaxed) +
+                         decisions
+                   : nodes.load(std::memory_order_relaxed);
+    size_t r = reduced > 0
+                   ? reductions.fetch_add(reduced, std::memory_order_relaxed) +
+                         reduced
+                   : reductions.load(std::memory_order_relaxed);
+    return (maxNodes > 0 && n >= maxNodes) ||
+           (maxReductions > 0 && r >= maxReductions);
+  }
+
+private:
+  size_t maxNodes;
+  size_t maxReductions;
+  std::atomic<size_t> nodes;
+  std::atomic<size_t> reductions;
+
+  SharedLimits(const SharedLimits&);
+  SharedLimits& operator=(const SharedLimits&);
+};
+
+/**
+ * Limits on the work of a search: nodes (decisions), calls to reduce and
+ * wall-clock seconds, zero meaning no limit. Once a limit is reached the
+ * search unwinds, and the budget still holds the most propagated board it was
+ * offered so that the caller gets the partial progress.
+ */
+class Budget {
+public:
+  Budget(size_t nodes = 0, size_t reductions = 0, double seconds = 0)
+      : maxNodes(nodes)
+      , maxReductions(reductions)
+      , timed(seconds > 0)
+      , deadline(std::chrono::steady_clock::now() +
+                 std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double>(seconds)))
+      , calls(0)
+      , over(false)
+      , bestOpen(0)
+      , token(nullptr)
+      , shared(nullptr)
+      , spentDecisions(0)
+      , spentReductions(0) {}
+
+  /**
+   * Returns true once any limit has been reached, or the token watched has
+   * been cancelled. The clock is only read every few calls.
+   */
+  bool exhausted(const Statistics& st) {
+    if (over) return true;
+    if (shared != nullptr) {
+      over = shared->spend(st.decisions - spentDecisions,
+                           st.reductions - spentReductions);
+      spentDecisions = st.decisions;
+      spentReductions = st.reductions;
+    }
+    if (over || (token != nullptr && token->cancelled()) ||
+        (maxNodes > 0 && st.decisions >= maxNodes) ||
+        (maxReductions > 0 && st.reductions >= maxReductions) ||
+        (timed && calls++ % 16 == 0 &&
+         std::chrono::steady_clock::now() >= deadline))
+      over = true;
+    return over;
+  }
+  bool out() const { return over; }
+  /**
+   * Marks the budget as used up, for searches that keep their own limits.
+   */
+  void exhaust() { over = true; }
+  /**
+   * Makes the budget run out as soon as t is cancelled.
+   */
+  void watch(const CancellationToken* t) { token = t; }
+  /**
+   * Replaces the node and reduction limits with limits, shared with other
+   * searches. The statistics given to exhausted must start from zero.
+   */
+  void share(SharedLimits* limits) {
+    shared = limits;
+    maxNodes = maxReductions = 0;
+    spentDecisions = spentReductions = 0;
+  }
+  /**
+   * The node and reduction limits left after used, for searches to share.
+   */
+  size_t nodesLeft(const Statistics& used) const {
+    return left(maxNodes, used.decisions, 1);
+  }
+  size_t reductionsLeft(const Statistics& used) const {
+    return left(maxReductions, used.reductions, 1);
+  }
+
+  /**
+   * Keeps s if it is more propagated than the best board seen so far.
+   */
+  void offer(const Sudoku& s) {
+    size_t open = s.candidateCount();
+    if (bestOpen == 0 || open < bestOpen) {
+      bestOpen = open;
+      bestBoard = s;
+    }
+  }
+  bool hasBest() const { return bestOpen > 0; }
+  const Sudoku& best() const { return bestBoard; }
+
+  /**
+   * The budget left after used, split among share searches that go on from
+   * there, with at most cap nodes each if cap is not zero. They keep the same
+   * deadline.
+   */
+  Budget split(const Statistics& used, size_t share, size_t cap = 0) const {
+    Budget b(*this);
+    b.maxNodes = left(maxNodes, used.decisions, share);
+    if (cap > 0 && (b.maxNodes == 0 || cap < b.maxNodes)) b.maxNodes = cap;
+    b.maxReductions = left(maxReductions, used.reductions, share);
+    b.calls = 0;
+    b.over = false;
+    b.bestOpen = 0;
+    return b;
+  }
+
+  /**
+   * Takes in the outcome of a budget split from this one: whether it ran out
+   * and its best board.
+   */
+  void merge(const Budget& other) {
+    over = over || other.over;
+    if (other.hasBest()) offer(other.best());
+  }
+
+private:
+  size_t maxNodes;
+  size_t maxReductions;
+  bool timed;
+  std::chrono::steady_clock::time_point deadline;
+  size_t calls;
+  bool over;
+  size_t bestOpen;
+  Sudoku bestBoard;
+  const CancellationToken* token;
+  SharedLimits* shared;
+  size_t spentDecisions;
+  size_t spentReductions;
+
+  static size_t left(size_t limit, size_t used, size_t share) {
+    if (limit == 0) return 0;
+    // Never zero, which would mean no limit.
+    return std::max<size_t>((limit - std::min(used, limit)) / share, 1);
+  }
+};
+
+/**
+ * What the solver entry points return. board is the solution (the first one
+ * for enumerations and counts); when no solution was found it is the most
+ * propagated board seen. For counts, stats.solutions is the number found.
+ */
+struct SearchResult {
+  Status status;
+  Sudoku board;
+  Statistics stats;
+};
+
+/**
+ * Propagation level used during a search. In automatic mode the search starts
+ * with naked singles and moves to the next level every time the number of
+ * nodes explored at the current level passes the threshold.
+ *
+ * With more than one thread, the search also gets a team of them to propagate
+ * large boards with (see Sudoku::reduce). Copies share the team, so they must
+ * not propagate at the same time.
+ */
+struct Propagation {
+  PropagationLevel level;
+  bool automatic;
+  size_t threshold;
+  size_t nodes;
+  std::shared_ptr<ThreadTeam> team;
+
+  Propagation(PropagationLevel l = PropagationLevel::NakedSingles,
+              size_t t = 100, size_t threads = 1)
+      : level(l == PropagationLevel::Auto ? PropagationLevel::NakedSingles : l)
+      , automatic(l == PropagationLevel::Auto)
+      , threshold(t)
+      , nodes(0)
+      , team(threads > 1 ? std::make_shared<ThreadTeam>(threads) : nullptr) {}
+
+  /**
+   * Accounts for a new node and returns the level to propagate it with.
+   */
+  PropagationLevel next() {
+    nodes++;
+    if (automatic && nodes > threshold && level < PropagationLevel::Probing) {
+      level = static_cast<PropagationLevel>(static_cast<int>(level) + 1);
+      nodes = 0;
+    }
+    return level;
+  }
+};
+
+/**
+ * A symmetry of the board: optional transposition, then a reordering of the
+ * rows and the columns (bands, stacks and the lines within them) and a
+ * relabeling of the values. Cell (i, j) of the transformed grid is
+ * labels[g[rows[i]][cols[j]]], g being the grid, transposed if needed.
+ * Grids are flat, row by row, with 0 for empty cells.
+ */
+struct Symmetry {
+  bool transposed;
+  vector<size_t> rows;
+  vector<size_t> cols;
+  vector<int> labels;
+
+  vector<int> apply(const vector<int>& g) const {
+    size_t N = rows.size();
+    vector<int> t(N * N);
+    for (size_t i = 0; i < N; i++)
+      for (size_t j = 0; j < N; j++)
+        t[i * N + j] = labels[at(g, rows[i], cols[j])];
+    return t;
+  }
+
+  vector<int> invert(const vector<int>& t) const {
+    size_t N = rows.size();
+    vector<int> inverse(N + 1), g(N * N);
+    for (size_t v = 0; v <= N; v++) inverse[labels[v]] = v;
+    for (size_t i = 0; i < N; i++)
+      for (size_t j = 0; j < N; j++) {
+        size_t r = rows[i], c = cols[j];
+        if (transposed) std::swap(r, c);
+        g[r * N + c] = inverse[t[i * N + j]];
+      }
+    return g;
+  }
+
+  int at(const vector<int>& g, size_t r, size_t c) const {
+    size_t N = rows.size();
+    return transposed ? g[c * N + r] : g[r * N + c];
+  }
+};
+
+/**
+ * Computes the minlex form of a grid: the lexicographically smallest grid
+ * among all its symmetric versions, along with the symmetry leading to it.
+ * Equivalent puzzles have the same minlex form.
+ *
+ * The rows of the result are fixed one at a time. Every candidate (a
+ * transposition, a column order and the labels given so far) is extended with
+ * each row it may take next, and only the candidates giving the smallest row
+ * survive. Candidates that can no longer be told apart are merged. Only boards
+ * with boxes of side up to 3 are supported: larger ones have too many column
+ * orders.
+ */
+class Minlex {
+public:
+  explicit Minlex(size_t n)
+      : n(n)
+      , N(n * n) {
+    assert(n <= 3);
+    vector<size_t> stacks(n), lines(n);
+    for (size_t k = 0; k < n; k++) stacks[k] = lines[k] = k;
+    // Every order of the stacks, combined with every order of the columns of
+    // each stack.
+    vector<vector<size_t>> within;
+    do within.push_back(lines);
+    while (std::next_permutation(lines.begin(), lines.end()));
+    do {
+      vector<size_t> pick(n, 0);
+      while (true) {
+        vector<size_t> order;
+        for (size_t k = 0; k < n; k++)
+          for (size_t l : within[pick[k]]) order.push_back(stacks[k] * n + l);
+        colOrders.push_back(order);
+        size_t k = 0;
+        while (k < n && ++pick[k] == within.size()) pick[k++] = 0;
+        if (k == n) break;
+      }
+    } while (std::next_permutation(stacks.begin(), stacks.end()));
+  }
+
+  size_t boxSize() const { return n; }
+
+  vector<int> canonical(const vector<int>& g, Symmetry& sym) const {
+    vector<Candidate> current, next;
+    for (int t = 0; t < 2; t++)
+      for (size_t c = 0; c < colOrders.size(); c++) {
+        Candidate cand = Candidate();
+        cand.transposed = t == 1;
+        cand.col = c;
+        cand.nextLabel = 1;
+        current.push_back(cand);
+      }
+
+    vector<int> result;
+    int best[maxDimension], row[maxDimension];
+    for (size_t r = 0; r < N; r++) {
+      next.clear();
+      bool first = true;
+      for (const Candidate& cand : current)
+        for (size_t x = 0; x < N; x++) {
+          if (!allowed(cand, r, x)) continue;
+          Candidate ext = cand;
+          const vector<size_t>& cols = colOrders[ext.col];
+          int cmp = first ? -1 : 0;
+          for (size_t j = 0; j < N; j++) {
+            int v = ext.transposed ? g[cols[j] * N + x] : g[x * N + cols[j]];
+            if (v != 0 && ext.labels[v] == 0) ext.labels[v] = ext.nextLabel++;
+            row[j] = ext.labels[v];
+            if (cmp == 0 && row[j] != best[j]) {
+              cmp = row[j] < best[j] ? -1 : 1;
+              if (cmp > 0) break;
+            }
+          }
+          if (cmp > 0) continue;
+          if (cmp < 0) {
+            next.clear();
+            std::copy(row, row + N, best);
+            first = false;
+          }
+          ext.used |= 1 << x;
+          ext.rows[r] = x;
+          next.push_back(ext);
+        }
+      result.insert(result.end(), best, best + N);
+      merge(next, r);
+      current.swap(next);
+    }
+
+    const Candidate& winner = current.front();
+    sym.transposed = winner.transposed;
+    sym.rows.assign(winner.rows, winner.rows + N);
+    sym.cols = colOrders[winner.col];
+    sym.labels.assign(winner.labels, winner.labels + N + 1);
+    // Values missing from the grid take the labels left, in order.
+    int label = winner.nextLabel;
+    for (size_t v = 1; v <= N; v++)
+      if (sym.labels[v] == 0) sym.labels[v] = label++;
+    return result;
+  }
+
+private:
+  enum { maxDimension = 9 };
+
+  struct Candidate {
+    bool transposed;
+    uint16_t col;
+    uint16_t used;
+    uint8_t rows[maxDimension];
+    int8_t labels[maxDimension + 1];
+    int8_t nextLabel;
+  };
+
+  size_t n;
+  size_t N;
+  vector<vector<size_t>> colOrders;
+
+  /**
+   * Whether row x can come at position r: the first row of a band opens any
+   * band not used yet, the others stay in the band of that first row.
+   */
+  bool allowed(const Candidate& cand, size_t r, size_t x) const {
+    if (cand.used & (1 << x)) return false;
+    if (r % n == 0) return (cand.used >> (x / n * n) & ((1 << n) - 1)) == 0;
+    return x / n == cand.rows[r - r % n] / n;
+  }
+
+  /**
+   * Drops the candidates whose remaining choices are the same as those of a
+   * previous one, r being the last row placed: they lead to the same grids.
+   */
+  void merge(vector<Candidate>& cands, size_t r) const {
+    std::unordered_set<uint64_t> seen;
+    size_t kept = 0;
+    for (size_t i = 0; i < cands.size(); i++) {
+      const Candidate& cand = cands[i];
+      // Column order, transposition, rows used, band being filled (11, 1, 9
+      // and 2 bits) and the labels given, 4 bits each.
+      uint64_t key = cand.col | uint64_t(cand.transposed) << 11 |
+                     uint64_t(cand.used) << 12 |
+                     uint64_t(cand.rows[r] / n) << 21;
+      for (size_t v = 1; v <= N; v++)
+        key |= uint64_t(cand.labels[v]) << (19 + 4 * v);
+      if (seen.insert(key).second) cands[kept++] = cand;
+    }
+    cands.resize(kept);
+  }
+};
+
+/**
+ * Least recently used cache of solutions, shared by equivalent puzzles: the
+ * key is the minlex form of the clues and the solution is stored in minlex
+ * coordinates, then mapped back through the symmetry of each puzzle.
+ *
+ * Only boards made of clues (every cell solved or with all its candidates)
+ * with boxes of side up to 3 go through the cache.
+ */
+class SolutionCache {
+public:
+  size_t hits;
+  size_t misses;
+
+  explicit SolutionCache(size_t capacity)
+      : hits(0)
+      , misses(0)
+      , capacity(capacity) {}
+
+  /**
+   * Looks for the solution of s. On a miss, the minlex form of s is kept for
+   * the insert of its solution.
+   */
+  bool lookup(const Sudoku& s, Sudoku& solution) {
+    if (!canonicalize(s)) return false;
+    auto it = index.find(lastKey);
+    if (it == index.end()) {
+      misses++;
+      return false;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    solution = Sudoku::fromGrid(lastSymmetry.invert(it->second->second));
+    return true;
+  }
+
+  void insert(const Sudoku& s, const Sudoku& solution) {
+    if (capacity == 0 || !canonicalize(s) || index.count(lastKey)) return;
+    entries.push_front({lastKey, lastSymmetry.apply(solution.grid())});
+    index[lastKey] = entries.begin();
+    if (entries.size() > capacity) {
+      index.erase(entries.back().first);
+      entries.pop_back();
+    }
+  }
+
+  size_t size() const { return entries.size(); }
+
+  void print() const {
+    fmt::print_colored(fmt::GREEN, "Cache hits: {}\t Misses: {}\t Size: {}\n",
+                       hits, misses, entries.size());
+  }
+
+private:
+  using Entry = pair<std::string, vector<int>>;
+
+  size_t capacity;
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  std::unique_ptr<Minlex> minlex;
+  // Last board canonicalized, its minlex form and symmetry.
+  vector<int> lastGrid;
+  std::string lastKey;
+  Symmetry lastSymmetry;
+
+  bool canonicalize(const Sudoku& s) {
+    if (s.boxSize() > 3 || !s.isClueBoard()) return false;
+    vector<int> g = s.grid();
+    if (g == lastGrid) return true;
+    if (!minlex || minlex->boxSize() != s.boxSize())
+      minlex.reset(new Minlex(s.boxSize()));
+    vector<int> form = minlex->canonical(g, lastSymmetry);
+    lastKey.assign(form.begin(), form.end());
+    lastGrid = g;
+    return true;
   }
 };
 
-pair<Sudoku, bool> solveOne(Sudoku& s, Statistics& st) {
-  s.reduce();
+/**
+ * How the solver entry points search.
+ */
+struct SolverOptions {
+  PropagationLevel level;
+  // Nodes explored at a level before Auto escalates to the next one.
+  size_t autoThreshold;
+  Engine engine;
+  // Randomized restarts for the backtracking engine, and their seed. The
+  // budget of the runs is restartUnit times the Luby sequence.
+  bool restarts;
+  unsigned seed;
+  size_t restartUnit;
+  // Budget of the search, zero meaning no limit.
+  size_t maxNodes;
+  size_t maxReductions;
+  double timeLimit;
+  // Seconds the local search engine runs for before giving up, as it cannot
+  // tell when a board has no solution. A lower timeLimit takes precedence.
+  double localSearchSeconds;
+  // Keeps the engines from printing statistics of their own, as the local
+  // search does at the end of a run.
+  bool quiet;
+  // Cache of solutions shared by the calls to solve, none if null.
+  SolutionCache* cache;
+  // Database of solutions behind the cache, none if null. New solutions are
+  // added to it when it is open for writing.
+  SolutionDatabase* database;
+  // Puzzles known to have no solution or more than one, none if null. solve
+  // and countSolutions check it first and record what they prove.
+  NegativeCache* rejects;
+  // Whether countSolutions must return a solution as its board. The cache of
+  // rejects has none, so it only answers for puzzles with several solutions
+  // when this is off, for checks that only look at the status.
+  bool needWitness;
+  // Entries of the transposition table of countSolutions, zero for none.
+  size_t tableSize;
+  // Threads of solve (backtracking without restarts) and solveAll, 1 for a
+  // sequential search.
+  size_t threads;
+  // Pin those threads, and the ones of batches, to CPUs, filling a NUMA node
+  // before the next (see Topology::placement).
+  bool pinThreads;
+  // Nodes solve explores alone before starting its threads, so that easy
+  // puzzles do not pay for them.
+  size_t sequentialNodes;
+  // Threads that propagate every board of 36x36 or more, in each thread of
+  // the search; 1 to propagate serially.
+  size_t propagationThreads;
+  // When not empty, solveAll saves its position to this file every
+  // checkpointInterval seconds, and with resume it starts from the position
+  // saved there.
+  std::string checkpointFile;
+  double checkpointInterval;
+  bool resume;
+
+  SolverOptions()
+      : level(PropagationLevel::NakedSingles)
+      , autoThreshold(100)
+      , engine(Engine::Backtracking)
+      , restarts(false)
+      , seed(0)
+      , restartUnit(100)
+      , maxNodes(0)
+      , maxReductions(0)
+      , timeLimit(0)
+      , localSearchSeconds(60)
+      , quiet(false)
+      , cache(nullptr)
+      , database(nullptr)
+      , rejects(nullptr)
+      , needWitness(true)
+      , tableSize(0)
+      , threads(1)
+      , pinThreads(false)
+      , sequentialNodes(64)
+      , propagationThreads(1)
+      , checkpointInterval(5)
+      , resume(false) {}
+
+  Budget budget() const { return Budget(maxNodes, maxReductions, timeLimit); }
+};
+
+/**
+ * State of a randomized run of solveOne: the generator used to break the ties
+ * of the branching heuristic and the number of nodes the run may explore.
+ */
+struct Restarts {
+  std::mt19937 rng;
+  size_t budget;
+  size_t nodes;
+
+  Restarts(unsigned seed)
+      : rng(seed)
+      , budget(0)
+      , nodes(0) {}
+  bool exhausted() const { return nodes >= budget; }
+};
+
+pair<Sudoku, bool> solveOne(Sudoku& s, Statistics& st, Propagation& p,
+                            Restarts* r = nullptr, Budget* b = nullptr,
+                            const CancellationToken* c = nullptr) {
+  if (c != nullptr && c->cancelled()) return {s, false};
+  if (r != nullptr && r->nodes++ >= r->budget) return {s, false};
+  if (b != nullptr && b->exhausted(st)) return {s, false};
+  s.reduce(p.next(), p.team.get());
   st.reductions++;
 
   if (s.isFailed()) {
     st.failures++;
     return {s, false};
-  } else if (s.isSolved()) {
+  }
+  if (b != nullptr) b->offer(s);
+  if (s.isSolved()) {
     st.solutions++;
     return {s, true};
   } else {
@@ -249,72 +1316,2457 @@ pair<Sudoku, bool> solveOne(Sudoku& s, Statistics& st) {
     // Make a decision: find the next cell to be solved and assign one of its
     // possible values to it.
     // Coordinate next = copy.nextCellTosolve();
-    Coordinate next = copy.smarterNextCellTosolve();
-    int val = copy.possibleValueForCell(next);
+    Coordinate next = r == nullptr ? copy.smarterNextCellTosolve()
+                                   : copy.smarterNextCellTosolve(r->rng);
+    int val = r == nullptr ? copy.possibleValueForCell(next)
+                           : copy.possibleValueForCell(next, r->rng);
     copy.assignValueForCell(next, val);
-    pair<Sudoku, bool> result = solveOne(copy, st);
+    pair<Sudoku, bool> result = solveOne(copy, st, p, r, b, c);
 
     if (result.second)
       return result;
     else {
       s.removeValueForCell(next, val);
-      return solveOne(s, st);
+      return solveOne(s, st, p, r, b, c);
     }
   }
 }
 
-vector<Sudoku> solveAll(Sudoku& s, Statistics& st) {
-  s.reduce();
-  st.reductions++;
+/**
+ * Runs solveOne with randomized tie-breaking and restarts it from scratch
+ * every time it explores more nodes than the Luby sequence allows: unit, unit,
+ * 2 unit, unit, unit, 2 unit, 4 unit... This cuts the heavy tail of the solving
+ * times, and the whole run is reproducible from the seed.
+ */
+pair<Sudoku, bool> solveWithRestarts(const Sudoku& s, Statistics& st,
+                                     Propagation& p, unsigned seed,
+                                     size_t unit, Budget* b = nullptr) {
+  Restarts r(seed);
+  for (size_t run = 0;; run++) {
+    r.budget = unit * luby(2, run);
+    r.nodes = 0;
+    Sudoku root(s);
+    pair<Sudoku, bool> sol = solveOne(root, st, p, &r, b);
+    // A run that did not use up its node allowance explored the whole tree.
+    if (sol.second || !r.exhausted() || (b != nullptr && b->out())) return sol;
+    st.restarts++;
+  }
+}
 
-  if (s.isFailed()) {
-    st.failures++;
-    return {};
+/**
+ * solveOne on a work-stealing pool of threads, for hard puzzles.
+ *
+ * The decisions of the top splitDepth levels are split: a task goes on with
+ * the value assigned, as solveOne would, and spawns the branch with the value
+ * removed, which idle workers steal. Below that depth tasks run solveOne on
+ * their subtree. The first solution found cancels every other task through a
+ * shared token. Every worker has its own shard of the statistics and
+ * propagation state, merged at the end, and its own copy of the budget, whose
+ * nodes and reductions are counted in limits shared by all of them.
+ */
+class ParallelSolveOne {
+public:
+  ParallelSolveOne(const SolverOptions& options, const Budget& budget,
+                   const Statistics& used)
+      : pool(options.threads, options.pinThreads)
+      , stats(pool.size())
+      , limits(budget.nodesLeft(used), budget.reductionsLeft(used))
+      , found(false) {
+    for (size_t i = 0; i < pool.size(); i++) {
+      workers.push_back({Propagation(options.level, options.autoThreshold,
+                                     options.propagationThreads),
+                         budget.split(used, 1)});
+      workers.back().budget.share(&limits);
+    }
   }
-  if (s.isSolved()) {
-    st.solutions++;
-    return {s};
+
+  /**
+   * The statistics so far, while the search runs in another thread.
+   */
+  Statistics progress() const { return stats.snapshot(); }
+
+  pair<Sudoku, bool> run(const Sudoku& s, Statistics& st, Budget& budget) {
+    pool.run([this, &s] {
+      Sudoku root(s);
+      explore(root, 0);
+    });
+    st += stats.snapshot();
+    for (const Worker& w : workers) budget.merge(w.budget);
+    if (found) return {solution, true};
+    return {s, false};
   }
 
-  st.decisions++;
-  Sudoku copy(s);
-  // Make a decision: find the next cell to be solved and assign one of its
-  // possible values to it.
-  // Coordinate next = copy.nextCellTosolve();
-  Coordinate next = copy.smarterNextCellTosolve();
-  int val = copy.possibleValueForCell(next);
-  copy.assignValueForCell(next, val);
-  vector<Sudoku> result = solveAll(copy, st);
+private:
+  struct Worker {
+    Propagation p;
+    Budget budget;
+  };
 
-  s.removeValueForCell(next, val);
-  vector<Sudoku> result2 = solveAll(s, st);
+  enum { splitDepth = 6 };
 
-  // Aggregate all the solutions
-  result.insert(result.end(), result2.begin(), result2.end());
-  return result;
-}
+  WorkStealingPool pool;
+  // One shard per worker.
+  Sharded<Statistics> stats;
+  SharedLimits limits;
+  vector<Worker> workers;
+  CancellationToken cancel;
+  std::mutex lock;
+  bool found;
+  Sudoku solution;
 
-void solve(const Sudoku& s) {
-  Statistics st;
-  Sudoku root(s);
-  pair<Sudoku, bool> sol = solveOne(root, st);
-  if (sol.second) {
-    sol.first.print();
+  void explore(Sudoku& s, size_t depth) {
+    Worker& w = workers[pool.worker()];
+    Statistics& st = stats.shard(pool.worker());
+    for (; depth < splitDepth; depth++) {
+      if (cancel.cancelled() || w.budget.exhausted(st)) return;
+      s.reduce(w.p.next(), w.p.team.get());
+      st.reductions++;
+
+      if (s.isFailed()) {
+        st.failures++;
+        return;
+      }
+      w.budget.offer(s);
+      if (s.isSolved()) {
+        st.solutions++;
+        publish(s);
+        return;
+      }
+
+      st.decisions++;
+      Coordinate next = s.smarterNextCellTosolve();
+      int val = s.possibleValueForCell(next);
+      std::shared_ptr<Sudoku> other = std::make_shared<Sudoku>(s);
+      other->removeValueForCell(next, val);
+      pool.spawn([this, other, depth] { explore(*other, depth + 1); });
+      s.assignValueForCell(next, val);
+    }
+    pair<Sudoku, bool> sol =
+        solveOne(s, st, w.p, nullptr, &w.budget, &cancel);
+    if (sol.second) publish(sol.first);
+  }
+
+  void publish(const Sudoku& s) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!found) {
+      solution = s;
+      found = true;
+    }
+    cancel.cancel();
+  }
+};
+
+/**
+ * solveOne on options.threads threads. The search explores the first
+ * options.sequentialNodes nodes alone, which is enough for easy puzzles, and
+ * only then starts the threads, with what is left of the budget.
+ */
+pair<Sudoku, bool> solveParallel(const Sudoku& s, Statistics& st,
+                                 Propagation& p, const SolverOptions& options,
+                                 Budget& budget) {
+  Budget alone = budget.split(Statistics(), 1, options.sequentialNodes);
+  Sudoku root(s);
+  pair<Sudoku, bool> sol = solveOne(root, st, p, nullptr, &alone);
+  if (!alone.out() || budget.exhausted(st)) {
+    budget.merge(alone);
+    return sol;
+  }
+  // The threads start over from the root, with the budget that is left.
+  if (alone.hasBest()) budget.offer(alone.best());
+  return ParallelSolveOne(options, budget, st).run(s, st, budget);
+}
+
+/**
+ * Receives the solutions of an enumeration as they are found. Returning false
+ * stops the enumeration.
+ */
+using SolutionVisitor = std::function<bool(const Sudoku&)>;
+
+/**
+ * Position of a solveAll enumeration, so that it can be saved to a file and
+ * resumed after a crash or preemption.
+ *
+ * The position is the path from the root to the node being explored. Every
+ * frame of the search contributes the branches it has finished (their value
+ * was removed) followed by the one it is exploring (its value was assigned),
+ * each with the level the board was reduced with before the decision.
+ * Replaying the path from the root rebuilds exactly the same boards, so the
+ * file only holds the root, the statistics and a few numbers per decision.
+ */
+class Checkpoint {
+public:
+  struct Step {
+    Coordinate cell;
+    int value;
+    bool assigned;
+    PropagationLevel level;
+  };
+
+  // Decisions on the current path. After a resume, the first replayEnd of
+  // them are replayed, replay being the next one.
+  vector<Step> path;
+  size_t replay;
+  size_t replayEnd;
+
+  Checkpoint(const Sudoku& root, const std::string& file, double interval)
+      : replay(0)
+      , replayEnd(0)
+      , root(root)
+      , file(file)
+      , interval(interval)
+      , last(std::chrono::steady_clock::now())
+      , calls(0) {}
+
+  bool replaying() const { return replay < replayEnd; }
+
+  /**
+   * Saves the position if the interval has passed since the last save. The
+   * clock is only read every few calls.
+   */
+  void tick(const Statistics& st, const Propagation& p) {
+    if (calls++ % 16 != 0) return;
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last).count() < interval) return;
+    save(st, p);
+    last = now;
+  }
+
+  /**
+   * Writes the position to the file. The file is replaced atomically, so a
+   * crash while saving leaves the previous checkpoint intact.
+   */
+  bool save(const Statistics& st, const Propagation& p) const {
+    std::string tmp = file + ".tmp";
+    {
+      std::ofstream out(tmp);
+      size_t N = root.dimension();
+      out << "sudoku-checkpoint 1\n" << N << "\n" << std::hex;
+      for (size_t c = 0; c < N * N; c++) out << mask(root, c) << " ";
+      out << std::dec << "\n"
+          << st.solutions << " " << st.failures << " " << st.decisions << " "
+          << st.reductions << " " << st.backjumps << " " << st.nogoods << " "
+          << st.restarts << "\n"
+          << int(p.level) << " " << p.automatic << " " << p.threshold << " "
+          << p.nodes << "\n"
+          << path.size() << "\n";
+      for (const Step& step : path)
+        out << step.cell.first << " " << step.cell.second << " " << step.value
+            << " " << step.assigned << " " << int(step.level) << "\n";
+      if (!out) return false;
+    }
+    return std::rename(tmp.c_str(), file.c_str()) == 0;
+  }
+
+  /**
+   * Reads the position saved in the file. Fails if there is no valid
+   * checkpoint of the same root board.
+   */
+  bool load(Statistics& st, Propagation& p) {
+    std::ifstream in(file);
+    std::string magic;
+    int version;
+    size_t N;
+    if (!(in >> magic >> version >> N) || magic != "sudoku-checkpoint" ||
+        version != 1 || N != root.dimension())
+      return false;
+    in >> std::hex;
+    for (size_t c = 0; c < N * N; c++) {
+      uint64_t m;
+      if (!(in >> m) || m != mask(root, c)) return false;
+    }
+    in >> std::dec;
+    Statistics saved;
+    Propagation propagation;
+    int level;
+    size_t steps;
+    in >> saved.solutions >> saved.failures >> saved.decisions >>
+        saved.reductions >> saved.backjumps >> saved.nogoods >>
+        saved.restarts >> level >> propagation.automatic >>
+        propagation.threshold >> propagation.nodes >> steps;
+    propagation.level = static_cast<PropagationLevel>(level);
+    vector<Step> savedPath(steps);
+    for (Step& step : savedPath) {
+      in >> step.cell.first >> step.cell.second >> step.value >>
+          step.assigned >> level;
+      step.level = static_cast<PropagationLevel>(level);
+    }
+    if (!in) return false;
+
+    st = saved;
+    p = propagation;
+    path.swap(savedPath);
+    replay = 0;
+    replayEnd = path.size();
+    return true;
+  }
+
+  void remove() const { std::remove(file.c_str()); }
+
+private:
+  Sudoku root;
+  std::string file;
+  double interval;
+  std::chrono::steady_clock::time_point last;
+  size_t calls;
+
+  static uint64_t mask(const Sudoku& s, size_t c) {
+    uint64_t m = 0;
+    for (int v : s.cellAt({c / s.dimension(), c % s.dimension()}))
+      m |= uint64_t(1) << (v - 1);
+    return m;
+  }
+};
+
+/**
+ * Enumerates the solutions of s, streaming each one to visit as soon as it is
+ * found. Apart from the search stack no memory is kept. Returns false if the
+ * visitor stopped the enumeration or the budget ran out.
+ *
+ * With a checkpoint the path of decisions is kept up to date in it and saved
+ * periodically, and when the budget runs out. A checkpoint that was loaded is
+ * first replayed to get back to the saved position.
+ */
+bool solveAll(Sudoku& s, Statistics& st, Propagation& p,
+              const SolutionVisitor& visit, Budget* b = nullptr,
+              Checkpoint* cp = nullptr) {
+  while (true) {
+    Coordinate next;
+    int val;
+    size_t mark = 0;
+    if (cp != nullptr && cp->replaying()) {
+      // Replayed nodes were already accounted for in the saved statistics.
+      mark = cp->replay++;
+      const Checkpoint::Step& step = cp->path[mark];
+      s.reduce(step.level, p.team.get());
+      next = step.cell;
+      val = step.value;
+      if (!step.assigned) {
+        s.removeValueForCell(next, val);
+        continue;
+      }
+    } else {
+      if (cp != nullptr) cp->tick(st, p);
+      if (b != nullptr && b->exhausted(st)) {
+        if (cp != nullptr) cp->save(st, p);
+        return false;
+      }
+      PropagationLevel level = p.next();
+      s.reduce(level, p.team.get());
+      st.reductions++;
+
+      if (s.isFailed()) {
+        st.failures++;
+        return true;
+      }
+      if (b != nullptr) b->offer(s);
+      if (s.isSolved()) {
+        st.solutions++;
+        return visit(s);
+      }
+
+      st.decisions++;
+      // Make a decision: find the next cell to be solved and assign one of
+      // its possible values to it.
+      // next = s.nextCellTosolve();
+      next = s.smarterNextCellTosolve();
+      val = s.possibleValueForCell(next);
+      if (cp != nullptr) {
+        mark = cp->path.size();
+        cp->path.push_back({next, val, true, level});
+      }
+    }
+
+    Sudoku copy(s);
+    copy.assignValueForCell(next, val);
+    if (!solveAll(copy, st, p, visit, b, cp)) return false;
+
+    // The other branch continues on s itself.
+    if (cp != nullptr) {
+      cp->path.resize(mark + 1);
+      cp->path[mark].assigned = false;
+    }
+    s.removeValueForCell(next, val);
+  }
+}
+
+vector<Sudoku> solveAll(Sudoku& s, Statistics& st, Propagation& p) {
+  vector<Sudoku> result;
+  solveAll(s, st, p, [&result](const Sudoku& sol) {
+    result.push_back(sol);
+    return true;
+  });
+  return result;
+}
+
+/**
+ * solveAll on a work-stealing pool of threads.
+ *
+ * The two branches of a decision are independent subtrees: a worker spawns
+ * the one assigning the value as a task and goes on with the other itself.
+ * Spawning is adaptive: a worker only spawns while its own deque is almost
+ * empty, which is the sign that the others are stealing its work, and never
+ * below a maximum depth. Every worker has its own shard of the statistics and
+ * propagation state, merged at the end. The limits on nodes and reductions
+ * are for the whole search: the workers count both in shared counters, so
+ * that one busy subtree can use the budget others leave. The visitor is called
+ * under a lock, one solution at a time.
+ *
+ * Checkpoints are not supported in this mode.
+ */
+class ParallelSolveAll {
+public:
+  ParallelSolveAll(const SolutionVisitor& visit, const SolverOptions& options)
+      : visit(visit)
+      , pool(options.threads, options.pinThreads)
+      , stats(pool.size())
+      , limits(options.maxNodes, options.maxReductions)
+      , stop(false)
+      , outOfBudget(false)
+      , haveFirst(false) {
+    for (size_t i = 0; i < pool.size(); i++) {
+      workers.push_back({Propagation(options.level, options.autoThreshold,
+                                     options.propagationThreads),
+                         Budget(0, 0, options.timeLimit)});
+      workers.back().budget.share(&limits);
+    }
+  }
+
+  /**
+   * The statistics so far, while the search runs in another thread.
+   */
+  Statistics progress() const { return stats.snapshot(); }
+
+  SearchResult run(const Sudoku& s) {
+    SearchResult result{Status::Unsolvable, s, Statistics()};
+    pool.run([this, &s] {
+      Sudoku root(s);
+      explore(root, 0);
+    });
+    result.stats = stats.snapshot();
+    bool partial = false;
+    for (const Worker& w : workers) {
+      // Without solutions, the board is the most propagated one of all.
+      if (outOfBudget && !haveFirst && w.budget.hasBest() &&
+          (!partial || w.budget.best().candidateCount() <
+                           result.board.candidateCount())) {
+        result.board = w.budget.best();
+        partial = true;
+      }
+    }
+    if (haveFirst) result.board = first;
+
+    if (outOfBudget)
+      result.status = Status::OutOfBudget;
+    else if (stop)
+      result.status = Status::Stopped;
+    else if (result.stats.solutions > 0)
+      result.status = Status::Solved;
+    return result;
+  }
+
+private:
+  struct Worker {
+    Propagation p;
+    Budget budget;
+  };
+
+  // Subtrees deeper than this are never spawned.
+  enum { maxSpawnDepth = 64 };
+
+  const SolutionVisitor& visit;
+  WorkStealingPool pool;
+  // One shard per worker.
+  Sharded<Statistics> stats;
+  // Decisions and reductions of all the workers.
+  SharedLimits limits;
+  vector<Worker> workers;
+  std::atomic<bool> stop;
+  std::atomic<bool> outOfBudget;
+  std::mutex visitLock;
+  bool haveFirst;
+  Sudoku first;
+
+  void explore(Sudoku& s, size_t depth) {
+    Worker& w = workers[pool.worker()];
+    Statistics& st = stats.shard(pool.worker());
+    while (true) {
+      if (stop) return;
+      if (w.budget.exhausted(st)) {
+        outOfBudget = true;
+        stop = true;
+        return;
+      }
+      s.reduce(w.p.next(), w.p.team.get());
+      st.reductions++;
+
+      if (s.isFailed()) {
+        st.failures++;
+        return;
+      }
+      w.budget.offer(s);
+      if (s.isSolved()) {
+        std::lock_guard<std::mutex> guard(visitLock);
+        if (stop) return;
+        st.solutions++;
+        if (!haveFirst) {
+          first = s;
+          haveFirst = true;
+        }
+        if (!visit(s)) stop = true;
+        return;
+      }
+
+      st.decisions++;
+      Coordinate next = s.smarterNextCellTosolve();
+      int val = s.possibleValueForCell(next);
+      Sudoku copy(s);
+      copy.assignValueForCell(next, val);
+      if (depth < maxSpawnDepth && pool.queued() < 2) {
+        // A task may outlive this frame: it owns its board.
+        std::shared_ptr<Sudoku> branch = std::make_shared<Sudoku>(copy);
+        pool.spawn([this, branch, depth] { explore(*branch, depth + 1); });
+      } else {
+        explore(copy, depth + 1);
+      }
+
+      // The other branch continues on s itself.
+      s.removeValueForCell(next, val);
+    }
+  }
+};
+
+/**
+ * Bounded cache of the number of solutions below search states, indexed by a
+ * 64-bit hash of the state. Buckets hold two entries; a new entry replaces the
+ * one that took less work to compute, so that the most expensive subtrees
+ * stay in the table.
+ */
+class TranspositionTable {
+public:
+  TranspositionTable(size_t entries)
+      : buckets(std::max<size_t>(entries / 2, 1)) {}
+
+  bool lookup(uint64_t key, size_t& count) const {
+    const Bucket& b = buckets[key % buckets.size()];
+    for (const Entry& e : b.entries)
+      if (e.work > 0 && e.key == key) {
+        count = e.count;
+        return true;
+      }
+    return false;
+  }
+
+  void store(uint64_t key, size_t count, size_t work) {
+    Bucket& b = buckets[key % buckets.size()];
+    Entry* victim = &b.entries[0];
+    for (Entry& e : b.entries) {
+      if (e.key == key) {
+        victim = &e;
+        break;
+      }
+      if (e.work < victim->work) victim = &e;
+    }
+    *victim = {key, count, std::max<size_t>(work, 1)};
+  }
+
+private:
+  struct Entry {
+    uint64_t key;
+    size_t count;
+    // Nodes the subtree took to count, zero for an empty entry.
+    size_t work;
+  };
+  struct Bucket {
+    Entry entries[2];
+  };
+  vector<Bucket> buckets;
+};
+
+/**
+ * Counts the solutions of a board, stopping as soon as a limit is reached.
+ *
+ * This is the hot path of puzzle generation and validation ("is the solution
+ * unique?" is count(2) == 1), so it does not go through Sudoku at all: every
+ * cell is a bitmask of candidates, the search states live in one preallocated
+ * stack of flat arrays, and the only board ever built is the witness (the
+ * first solution found). Propagation is naked and hidden singles.
+ *
+ * Different decision orders often reach the same remaining problem, where
+ * only the values placed differ: the open cells and their candidates are
+ * identical and so is the number of solutions below. With a transposition
+ * table those counts are reused. The key is a Zobrist hash of the candidates
+ * of the open cells, updated as candidates are removed.
+ */
+class SolutionCounter {
+public:
+  enum { maxDimension = 64 };
+
+  SolutionCounter(const Sudoku& s, size_t tableSize = 0)
+      : SolutionCounter(s.boxSize(), candidates(s), tableSize) {}
+
+  /**
+   * A counter for the boards with boxes of side n, starting from the given
+   * candidates: bit v - 1 of cell i * N + j stands for value v.
+   */
+  SolutionCounter(size_t n, const vector<uint64_t>& candidates,
+                  size_t tableSize = 0)
+      : N(n * n)
+      , cells(N * N)
+      , full(N == 64 ? ~uint64_t(0) : (uint64_t(1) << N) - 1)
+      , peers(cells)
+      , root(candidates)
+      , stack(cells)
+      , zobrist(cells * N)
+      , table(tableSize > 0 ? new TranspositionTable(tableSize) : nullptr) {
+    assert(N <= maxDimension && root.size() == cells);
+    for (const auto& unit : Sudoku::unitsFor(n)) {
+      units.push_back({});
+      for (const auto& c : unit) units.back().push_back(c.first * N + c.second);
+    }
+    for (const auto& unit : units)
+      for (size_t a : unit)
+        for (size_t b : unit)
+          if (a != b && std::find(peers[a].begin(), peers[a].end(), b) ==
+                            peers[a].end())
+            peers[a].push_back(b);
+    std::mt19937_64 rng(0);
+    for (uint64_t& key : zobrist) key = rng();
+  }
+
+  static vector<uint64_t> candidates(const Sudoku& s) {
+    size_t N = s.dimension();
+    vector<uint64_t> masks(N * N, 0);
+    for (size_t c = 0; c < N * N; c++)
+      for (int v : s.cellAt({c / N, c % N})) masks[c] |= uint64_t(1) << (v - 1);
+    return masks;
+  }
+
+  /**
+   * Changes the candidates the next counts start from.
+   */
+  void setCandidates(const vector<uint64_t>& candidates) {
+    assert(candidates.size() == cells);
+    root = candidates;
+  }
+
+  /**
+   * Returns the number of solutions, counting at most limit of them.
+   */
+  size_t count(size_t limit, Statistics& st, Budget* b = nullptr) {
+    if (prepare(st, b)) search(0, limit, st);
+    return found;
+  }
+
+  /**
+   * The first solution found by count, and the same row by row.
+   */
+  Sudoku witness() const { return Sudoku::fromGrid(first); }
+  const vector<int>& witnessGrid() const { return first; }
+
+private:
+  size_t N;
+  size_t cells;
+  uint64_t full;
+  vector<vector<size_t>> units;
+  vector<vector<size_t>> peers;
+  vector<uint64_t> root;
+  // The state at depth k is stack[k * cells, (k + 1) * cells).
+  vector<uint64_t> stack;
+  // Cells that became solved and still have to be removed from their peers.
+  vector<size_t> queue;
+  size_t found;
+  vector<int> first;
+  Budget* budget;
+  // Random key of every candidate of every cell, and hash of the state being
+  // propagated.
+  vector<uint64_t> zobrist;
+  uint64_t hash;
+  std::unique_ptr<TranspositionTable> table;
+
+  static bool single(uint64_t m) { return (m & (m - 1)) == 0; }
+
+  uint64_t keys(size_t c, uint64_t m) const {
+    uint64_t k = 0;
+    for (; m != 0; m &= m - 1) k ^= zobrist[c * N + __builtin_ctzll(m)];
+    return k;
+  }
+
+  /**
+   * Narrows cell c of d to m, keeping the hash up to date: solved cells are
+   * not part of it.
+   */
+  void narrow(uint64_t* d, size_t c, uint64_t m) {
+    hash ^= keys(c, d[c] & ~m);
+    if (single(m)) hash ^= keys(c, m);
+    d[c] = m;
+  }
+
+  bool propagate(size_t depth) {
+    uint64_t* d = &stack[depth * cells];
+    while (true) {
+      while (!queue.empty()) {
+        size_t c = queue.back();
+        queue.pop_back();
+        for (size_t p : peers[c])
+          if (d[p] & d[c]) {
+            narrow(d, p, d[p] & ~d[c]);
+            if (d[p] == 0) return false;
+            if (single(d[p])) queue.push_back(p);
+          }
+      }
+
+      for (const auto& unit : units) {
+        uint64_t once = 0, more = 0;
+        for (size_t c : unit) {
+          more |= once & d[c];
+          once |= d[c];
+        }
+        if (once != full) return false;
+        uint64_t hidden = once & ~more;
+        if (hidden == 0) continue;
+        for (size_t c : unit)
+          if ((d[c] & hidden) && !single(d[c])) {
+            if (!single(d[c] & hidden)) return false;
+            narrow(d, c, d[c] & hidden);
+            queue.push_back(c);
+          }
+      }
+      if (queue.empty()) return true;
+    }
+  }
+
+  /**
+   * Resets the count and propagates the root. Returns false if that fails.
+   */
+  bool prepare(Statistics& st, Budget* b) {
+    found = 0;
+    budget = b;
+    queue.clear();
+    std::copy(root.begin(), root.end(), stack.begin());
+    hash = 0;
+    for (size_t c = 0; c < cells; c++)
+      if (single(stack[c]))
+        queue.push_back(c);
+      else
+        hash ^= keys(c, stack[c]);
+    st.reductions++;
+    if (propagate(0)) return true;
+    st.failures++;
+    return false;
+  }
+
+  /**
+   * The open cell with the fewest candidates at depth, or cells if all of
+   * them are solved.
+   */
+  size_t pick(size_t depth) const {
+    const uint64_t* d = &stack[depth * cells];
+    size_t next = cells;
+    int minCard = N + 1;
+    for (size_t c = 0; c < cells; c++) {
+      int card = __builtin_popcountll(d[c]);
+      if (card > 1 && card < minCard) {
+        minCard = card;
+        next = c;
+      }
+    }
+    return next;
+  }
+
+  void solution(size_t depth, Statistics& st) {
+    if (found++ == 0) saveWitness(&stack[depth * cells]);
+    st.solutions++;
+  }
+
+  /**
+   * Adds the count stored for key, if there is one that can be reused.
+   */
+  bool reuse(uint64_t key, Statistics& st) {
+    size_t cached;
+    st.lookups++;
+    // A later count on the same counter still has to find its witness.
+    if (!table->lookup(key, cached) || (cached != 0 && found == 0))
+      return false;
+    st.hits++;
+    found += cached;
+    st.solutions += cached;
+    return true;
+  }
+
+  /**
+   * Sets up depth + 1 as the state at depth with cell next narrowed to value,
+   * whose hash there is key, and propagates it. Returns false if that fails.
+   */
+  bool branch(size_t depth, size_t next, uint64_t value, uint64_t key,
+              Statistics& st) {
+    st.decisions++;
+    st.reductions++;
+    std::copy(stack.begin() + depth * cells,
+              stack.begin() + (depth + 1) * cells,
+              stack.begin() + (depth + 1) * cells);
+    hash = key;
+    narrow(&stack[(depth + 1) * cells], next, value);
+    queue.assign(1, next);
+    if (propagate(depth + 1)) return true;
+    st.failures++;
+    return false;
+  }
+
+  bool stopped(size_t limit) const {
+    return found >= limit || (budget != nullptr && budget->out());
+  }
+
+  void search(size_t depth, size_t limit, Statistics& st) {
+    if (budget != nullptr && budget->exhausted(st)) return;
+    size_t next = pick(depth);
+    if (next == cells) {
+      solution(depth, st);
+      return;
+    }
+
+    uint64_t key = hash;
+    size_t before = found, nodes = st.decisions;
+    if (table && reuse(key, st)) return;
+
+    if (stack.size() < (depth + 2) * cells) stack.resize((depth + 2) * cells);
+    for (uint64_t rest = stack[depth * cells + next]; rest != 0;
+         rest &= rest - 1) {
+      if (branch(depth, next, rest & -rest, key, st))
+        search(depth + 1, limit, st);
+      if (stopped(limit)) return;
+    }
+    // Only the counts of subtrees explored to the end can be reused.
+    if (table) table->store(key, found - before, st.decisions - nodes);
+  }
+
+  void saveWitness(const uint64_t* d) {
+    first.resize(cells);
+    for (size_t c = 0; c < cells; c++) first[c] = __builtin_ctzll(d[c]) + 1;
+  }
+};
+
+/**
+ * The status of a count of solutions that stopped at limit, or ran out of
+ * budget if out.
+ */
+Status countStatus(size_t count, size_t limit, bool out) {
+  if (out) return Status::OutOfBudget;
+  if (count >= limit) return Status::Stopped;
+  return count > 0 ? Status::Solved : Status::Unsolvable;
+}
+
+/**
+ * Counts the solutions of s, stopping at limit. The status is Stopped when
+ * the limit was reached, and board is the first solution found, unless the
+ * negative cache answered without searching (see needWitness).
+ */
+SearchResult countSolutions(const Sudoku& s, size_t limit = 2,
+                            const SolverOptions& options = SolverOptions()) {
+  SearchResult result{Status::Unsolvable, s, Statistics()};
+  bool known = options.rejects != nullptr && s.isClueBoard();
+  if (known) {
+    NegativeCache::Verdict verdict = options.rejects->lookup(s.grid());
+    if (verdict == NegativeCache::Unsolvable) return result;
+    // At least two solutions, but none of them known: the board stays the
+    // puzzle itself.
+    if (verdict == NegativeCache::NotUnique && limit <= 2 &&
+        !options.needWitness) {
+      result.status = Status::Stopped;
+      result.stats.solutions = limit;
+      return result;
+    }
+  }
+  Budget budget = options.budget();
+  SolutionCounter counter(s, options.tableSize);
+  size_t count = counter.count(limit, result.stats, &budget);
+  if (count > 0) result.board = counter.witness();
+  result.status = countStatus(count, limit, budget.out());
+  if (known && !budget.out() && count != 1)
+    options.rejects->insert(s.grid(), count == 0 ? NegativeCache::Unsolvable
+                                                 : NegativeCache::NotUnique);
+  return result;
+}
+
+/**
+ * Editing session of a puzzle, for editors that change one clue at a time.
+ *
+ * The session keeps two layers of candidates. The base layer only has the
+ * eliminations made directly by the clues: every candidate counts the clues
+ * among the peers of its cell that hold its value, so adding or removing a
+ * clue only touches its peers. The propagated layer adds naked and hidden
+ * singles on top. Adding a clue propagates just that change. Removing one
+ * updates the base layer of its peers, but a removal may bring back
+ * candidates anywhere, so the propagated layer is then rebuilt from the whole
+ * base layer, as costly as a fresh propagation.
+ *
+ * check() tells whether the puzzle has no solution, one, or more, and reuses
+ * the last answer when the edits allow it: a clue added to a puzzle without
+ * solution, or agreeing with its unique solution, or a clue removed from a
+ * puzzle with several solutions, need no search.
+ */
+class EditSession {
+public:
+  explicit EditSession(const Sudoku& s)
+      : n(s.boxSize())
+      , N(n * n)
+      , cells(N * N)
+      , full(N == 64 ? ~uint64_t(0) : (uint64_t(1) << N) - 1)
+      , clues(cells, 0)
+      , support(cells * N, 0)
+      , base(cells, full)
+      , current(cells, full)
+      , peers(cells)
+      , counter(n, current)
+      , known(false) {
+    for (const auto& unit : Sudoku::unitsFor(n)) {
+      units.push_back({});
+      for (const auto& c : unit) units.back().push_back(c.first * N + c.second);
+    }
+    for (const auto& unit : units)
+      for (size_t a : unit)
+        for (size_t b : unit)
+          if (a != b && std::find(peers[a].begin(), peers[a].end(), b) ==
+                            peers[a].end())
+            peers[a].push_back(b);
+    vector<int> g = s.grid();
+    for (size_t c = 0; c < cells; c++)
+      if (g[c] != 0) setClue(c, g[c]);
+    repropagate();
+  }
+
+  /**
+   * Sets the clue of cell c to v, replacing the one it had. Returns false,
+   * leaving the session as it was, if c is not on the board or v is not a
+   * value of it.
+   */
+  bool addClue(const Coordinate& c, int v) {
+    if (c.first >= N || c.second >= N || v < 1 || v > int(N)) return false;
+    size_t cell = c.first * N + c.second;
+    if (clues[cell] == v) return true;
+    if (clues[cell] != 0) removeClue(c);
+    setClue(cell, v);
+
+    // The base layer only lost candidates: narrowing the propagated layer
+    // and propagating from there reaches the same state as starting over,
+    // as long as every cell that became a single goes through the queue.
+    current[cell] &= base[cell];
+    queue.assign(1, cell);
+    for (size_t p : peers[cell]) {
+      uint64_t m = current[p] & base[p];
+      if (m != current[p] && single(m)) queue.push_back(p);
+      current[p] = m;
+    }
+    failed = !propagate();
+
+    if (known) {
+      if (status == Status::Solved && solution[cell] != v)
+        status = Status::Unsolvable;
+      else if (status == Status::Stopped)
+        known = false;
+    }
+    return true;
+  }
+
+  /**
+   * Empties cell c, if it is on the board and has a clue.
+   */
+  void removeClue(const Coordinate& c) {
+    if (c.first >= N || c.second >= N) return;
+    size_t cell = c.first * N + c.second;
+    int v = clues[cell];
+    if (v == 0) return;
+    clues[cell] = 0;
+    for (size_t p : peers[cell]) support[p * N + v - 1]--;
+    for (size_t p : peers[cell]) base[p] = baseOf(p);
+    base[cell] = baseOf(cell);
+    repropagate();
+
+    // More solutions than before: only "several" stays true.
+    if (known && status != Status::Stopped) known = false;
+  }
+
+  bool isFailed() const { return failed; }
+
+  /**
+   * The propagated board.
+   */
+  Sudoku board() const {
+    vector<vector<int>> values(N, vector<int>(N, 0));
+    Sudoku s(values);
+    for (size_t c = 0; c < cells; c++)
+      for (size_t v = 1; v <= N; v++)
+        if (!(current[c] >> (v - 1) & 1))
+          s.removeValueForCell({c / N, c % N}, v);
+    return s;
+  }
+
+  /**
+   * Solved when the puzzle has a unique solution, Stopped when it has more
+   * than one and Unsolvable when it has none.
+   */
+  Status check(Statistics& st) {
+    if (failed) return Status::Unsolvable;
+    if (known) return status;
+    counter.setCandidates(current);
+    size_t count = counter.count(2, st);
+    status = count == 0 ? Status::Unsolvable
+                        : count == 1 ? Status::Solved : Status::Stopped;
+    if (count > 0) solution = counter.witnessGrid();
+    known = true;
+    return status;
+  }
+
+  /**
+   * A solution, once check has found one.
+   */
+  Sudoku witness() const { return Sudoku::fromGrid(solution); }
+
+private:
+  size_t n;
+  size_t N;
+  size_t cells;
+  uint64_t full;
+  vector<int> clues;
+  // Clues among the peers of cell c that hold value v, at c * N + v - 1.
+  vector<size_t> support;
+  vector<uint64_t> base;
+  vector<uint64_t> current;
+  vector<vector<size_t>> units;
+  vector<vector<size_t>> peers;
+  vector<size_t> queue;
+  bool failed;
+  SolutionCounter counter;
+  // Answer of the last check, while the edits since then keep it valid.
+  bool known;
+  Status status;
+  vector<int> solution;
+
+  static bool single(uint64_t m) { return (m & (m - 1)) == 0; }
+
+  uint64_t baseOf(size_t c) const {
+    uint64_t m = clues[c] == 0 ? full : uint64_t(1) << (clues[c] - 1);
+    for (size_t v = 1; v <= N; v++)
+      if (support[c * N + v - 1] > 0) m &= ~(uint64_t(1) << (v - 1));
+    return m;
+  }
+
+  void setClue(size_t cell, int v) {
+    clues[cell] = v;
+    for (size_t p : peers[cell]) {
+      support[p * N + v - 1]++;
+      base[p] &= ~(uint64_t(1) << (v - 1));
+    }
+    base[cell] = baseOf(cell);
+  }
+
+  void repropagate() {
+    current = base;
+    queue.clear();
+    for (size_t c = 0; c < cells; c++)
+      if (single(current[c])) queue.push_back(c);
+    failed = !propagate();
+  }
+
+  /**
+   * Naked singles from the cells in the queue, then hidden singles, until
+   * nothing changes. Returns false on a contradiction.
+   */
+  bool propagate() {
+    uint64_t* d = current.data();
+    for (size_t c = 0; c < cells; c++)
+      if (d[c] == 0) return false;
+    while (true) {
+      while (!queue.empty()) {
+        size_t c = queue.back();
+        queue.pop_back();
+        for (size_t p : peers[c])
+          if (d[p] & d[c]) {
+            d[p] &= ~d[c];
+            if (d[p] == 0) return false;
+            if (single(d[p])) queue.push_back(p);
+          }
+      }
+
+      for (const auto& unit : units) {
+        uint64_t once = 0, more = 0;
+        for (size_t c : unit) {
+          more |= once & d[c];
+          once |= d[c];
+        }
+        if (once != full) return false;
+        uint64_t hidden = once & ~more;
+        if (hidden == 0) continue;
+        for (size_t c : unit)
+          if ((d[c] & hidden) && !single(d[c])) {
+            d[c] &= hidden;
+            if (!single(d[c])) return false;
+            queue.push_back(c);
+          }
+      }
+      if (queue.empty()) return true;
+    }
+  }
+};
+
+/**
+ * Depth-first search with conflict-directed backjumping and nogood learning.
+ *
+ * Every elimination records the set of decision levels that caused it. When a
+ * branch fails, the union of those sets tells which decisions are really to
+ * blame: the search jumps straight back to the most recent of them instead of
+ * retrying the previous decision, and remembers the offending combination of
+ * assignments as a nogood that prunes the rest of the search.
+ *
+ * Propagation is naked singles, plus hidden singles from the HiddenSingles
+ * level up. The stronger reductions of Sudoku::reduce have no explanations.
+ * Boards up to 25x25 are supported.
+ */
+class ConflictSearch {
+public:
+  enum { maxDimension = 25 };
+
+private:
+  // One bit per decision level, level 0 being the root.
+  using Levels = std::bitset<maxDimension * maxDimension + 1>;
+
+  struct Literal {
+    size_t cell;
+    int value;
+  };
+  using Nogood = vector<Literal>;
+
+  enum { maxNogoods = 1000, maxNogoodSize = 10 };
+
+  size_t dimension;
+  size_t cells;
+  vector<vector<size_t>> units;
+  vector<vector<size_t>> peers;
+  // Bit v is set when v is a candidate of the cell.
+  vector<uint32_t> domain;
+  // why[c][v] is the set of decision levels that removed v from c.
+  vector<vector<Levels>> why;
+  vector<Literal> trail;
+  // decisions[l - 1] is the assignment made at decision level l.
+  vector<Literal> decisions;
+  vector<Nogood> nogoods;
+  size_t oldestNogood;
+  bool hiddenSingles;
+  Budget* budget;
+  // Most propagated domains seen, and their number of candidates.
+  vector<uint32_t> best;
+  size_t bestOpen;
+
+public:
+  ConflictSearch(const Sudoku& s,
+                 PropagationLevel level = PropagationLevel::NakedSingles)
+      : dimension(s.dimension())
+      , cells(dimension * dimension)
+      , peers(cells)
+      , domain(cells, 0)
+      , why(cells, vector<Levels>(dimension + 1))
+      , oldestNogood(0)
+      , hiddenSingles(level >= PropagationLevel::HiddenSingles)
+      , budget(nullptr)
+      , bestOpen(0) {
+    assert(dimension <= maxDimension);
+    for (const auto& unit : s.units()) {
+      units.push_back({});
+      for (const auto& c : unit) units.back().push_back(index(c));
+    }
+    for (const auto& unit : units)
+      for (size_t a : unit)
+        for (size_t b : unit)
+          if (a != b && std::find(peers[a].begin(), peers[a].end(), b) ==
+                            peers[a].end())
+            peers[a].push_back(b);
+    for (size_t c = 0; c < cells; c++)
+      for (int v : s.cellAt({c / dimension, c % dimension}))
+        domain[c] |= 1 << v;
+  }
+
+  /**
+   * Searches for a solution. When there is none, or the budget runs out, the
+   * board returned is the most propagated one the search went through.
+   */
+  pair<Sudoku, bool> solve(Statistics& st, Budget* b = nullptr) {
+    budget = b;
+    best = domain;
+    bestOpen = cells * dimension + 1;
+    Levels conflict;
+    if (!search(0, conflict, st)) return {board(best), false};
+    return {board(domain), true};
+  }
+
+private:
+  bool has(size_t c, int v) const { return domain[c] & (1 << v); }
+  size_t size(size_t c) const { return __builtin_popcount(domain[c]); }
+  int valueOf(size_t c) const { return __builtin_ctz(domain[c]); }
+
+  size_t index(const Coordinate& c) const {
+    return c.first * dimension + c.second;
+  }
+
+  Sudoku board(const vector<uint32_t>& d) const {
+    vector<vector<int>> values(dimension, vector<int>(dimension, 0));
+    for (size_t c = 0; c < cells; c++)
+      if (__builtin_popcount(d[c]) == 1)
+        values[c / dimension][c % dimension] = __builtin_ctz(d[c]);
+    Sudoku s(values);
+    for (size_t c = 0; c < cells; c++)
+      for (int v = 1; v <= int(dimension); v++)
+        if (!(d[c] & (1 << v))) s.removeValueForCell({c / dimension, c % dimension}, v);
+    return s;
+  }
+
+  void eliminate(size_t c, int v, const Levels& reason) {
+    domain[c] &= ~(1 << v);
+    why[c][v] = reason;
+    trail.push_back({c, v});
+  }
+
+  void undo(size_t mark) {
+    while (trail.size() > mark) {
+      domain[trail.back().cell] |= 1 << trail.back().value;
+      trail.pop_back();
+    }
+  }
+
+  /**
+   * Decisions responsible for the values missing from the cell: for a solved
+   * cell, the reason it holds its value; for an empty one, the conflict.
+   */
+  Levels missing(size_t c) const {
+    Levels r;
+    for (int v = 1; v <= int(dimension); v++)
+      if (!has(c, v)) r |= why[c][v];
+    return r;
+  }
+
+  /**
+   * Propagates to a fixpoint. On a contradiction returns false and fills
+   * conflict with the decision levels that produced it.
+   */
+  bool propagate(Levels& conflict) {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t c = 0; c < cells; c++) {
+        if (domain[c] == 0) {
+          conflict = missing(c);
+          return false;
+        }
+        if (size(c) != 1) continue;
+        int v = valueOf(c);
+        for (size_t p : peers[c])
+          if (has(p, v)) {
+            eliminate(p, v, missing(c));
+            changed = true;
+          }
+      }
+      if (changed) continue;
+
+      if (hiddenSingles)
+        for (const auto& unit : units)
+          for (int v = 1; v <= int(dimension); v++) {
+            size_t count = 0, place = 0;
+            Levels reason;
+            for (size_t c : unit) {
+              if (has(c, v)) {
+                count++;
+                place = c;
+              } else {
+                reason |= why[c][v];
+              }
+            }
+            if (count == 0) {
+              conflict = reason;
+              return false;
+            }
+            if (count == 1 && size(place) > 1) {
+              for (int u = 1; u <= int(dimension); u++)
+                if (u != v && has(place, u)) eliminate(place, u, reason);
+              changed = true;
+            }
+          }
+      if (changed) continue;
+
+      for (const auto& nogood : nogoods) {
+        Levels reason;
+        const Literal* open = nullptr;
+        size_t unassigned = 0;
+        bool satisfied = false;
+        for (const auto& l : nogood) {
+          if (!has(l.cell, l.value)) {
+            satisfied = true;
+            break;
+          }
+          if (size(l.cell) > 1) {
+            open = &l;
+            unassigned++;
+          } else {
+            reason |= missing(l.cell);
+          }
+        }
+        if (satisfied || unassigned > 1) continue;
+        if (unassigned == 0) {
+          conflict = reason;
+          return false;
+        }
+        eliminate(open->cell, open->value, reason);
+        changed = true;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Records that the decisions in conflict together with the assignment of v
+   * to c cannot hold. The oldest nogood is replaced once the store is full.
+   */
+  void learn(const Levels& conflict, size_t c, int v, Statistics& st) {
+    if (conflict.count() + 1 > maxNogoodSize) return;
+    Nogood nogood{{c, v}};
+    for (size_t l = 1; l <= decisions.size(); l++)
+      if (conflict.test(l)) nogood.push_back(decisions[l - 1]);
+    st.nogoods++;
+    if (nogoods.size() < maxNogoods) {
+      nogoods.push_back(nogood);
+    } else {
+      nogoods[oldestNogood] = nogood;
+      oldestNogood = (oldestNogood + 1) % maxNogoods;
+    }
+  }
+
+  /**
+   * Searches below decision level `level`. Returns true when the board is
+   * solved; otherwise conflict holds the decisions the failure depends on.
+   */
+  bool search(size_t level, Levels& conflict, Statistics& st) {
+    while (true) {
+      if (budget != nullptr && budget->exhausted(st)) return false;
+      st.reductions++;
+      if (!propagate(conflict)) {
+        st.failures++;
+        return false;
+      }
+
+      size_t next = cells, minCard = dimension + 1, open = 0;
+      for (size_t c = 0; c < cells; c++) {
+        open += size(c);
+        if (size(c) > 1 && size(c) < minCard) {
+          minCard = size(c);
+          next = c;
+        }
+      }
+      if (open < bestOpen) {
+        bestOpen = open;
+        best = domain;
+      }
+      if (next == cells) {
+        st.solutions++;
+        return true;
+      }
+
+      st.decisions++;
+      int val = valueOf(next);
+      size_t mark = trail.size();
+      decisions.push_back({next, val});
+      Levels decision;
+      decision.set(level + 1);
+      for (int u = 1; u <= int(dimension); u++)
+        if (u != val && has(next, u)) eliminate(next, u, decision);
+
+      Levels sub;
+      if (search(level + 1, sub, st)) return true;
+      if (budget != nullptr && budget->out()) return false;
+      undo(mark);
+      decisions.pop_back();
+
+      if (!sub.test(level + 1)) {
+        // The decision played no part in the failure: jump over it.
+        st.backjumps++;
+        conflict = sub;
+        return false;
+      }
+      sub.reset(level + 1);
+      learn(sub, next, val, st);
+      eliminate(next, val, sub);
+    }
+  }
+};
+
+/**
+ * Solves the board with the CDCL engine. On an N x N board variable
+ * N^2 * r + N * c + v stands for "cell (r, c) holds v", which makes 729
+ * variables for the classic board: every cell holds exactly one value and every
+ * unit holds every value exactly once. The values already eliminated from the
+ * board become unit clauses.
+ */
+pair<Sudoku, bool> solveSat(const Sudoku& s, Statistics& st,
+                            Budget* b = nullptr) {
+  const size_t N = s.dimension();
+  SatSolver sat;
+  auto var = [N](size_t r, size_t c, int v) { return int(N * N * r + N * c + v); };
+  for (size_t k = 0; k < N * N * N; k++) sat.newVar();
+
+  auto exactlyOne = [&sat](const vector<int>& vars) {
+    sat.addClause(vars);
+    for (size_t a = 0; a < vars.size(); a++)
+      for (size_t b = a + 1; b < vars.size(); b++)
+        sat.addClause({-vars[a], -vars[b]});
+  };
+  for (size_t r = 0; r < N; r++)
+    for (size_t c = 0; c < N; c++) {
+      vector<int> cell;
+      for (int v = 1; v <= int(N); v++) {
+        cell.push_back(var(r, c, v));
+        if (!s.cellAt({r, c}).count(v)) sat.addClause({-var(r, c, v)});
+      }
+      exactlyOne(cell);
+    }
+  for (const auto& unit : s.units())
+    for (int v = 1; v <= int(N); v++) {
+      vector<int> places;
+      for (const auto& c : unit) places.push_back(var(c.first, c.second, v));
+      exactlyOne(places);
+    }
+
+  if (b != nullptr)
+    sat.terminate = [&st, &sat, b]() {
+      Statistics now(st);
+      now.decisions += sat.decisions;
+      now.failures += sat.conflicts;
+      return b->exhausted(now);
+    };
+  bool found = sat.solve() == SatSolver::Satisfiable;
+  st.decisions += sat.decisions;
+  st.failures += sat.conflicts;
+  if (!found) return {s, false};
+  st.solutions++;
+  vector<vector<int>> values(N, vector<int>(N));
+  for (size_t r = 0; r < N; r++)
+    for (size_t c = 0; c < N; c++)
+      for (int v = 1; v <= int(N); v++)
+        if (sat.modelValue(var(r, c, v))) values[r][c] = v;
+  return {Sudoku(values), true};
+}
+
+/**
+ * Stochastic local search for the very large boards, where complete search
+ * takes too long. The clues stay fixed and every box is filled with a
+ * permutation of its missing values, so the boxes are always right; simulated
+ * annealing then swaps two free cells of a box at a time to drive the number
+ * of row and column conflicts down to zero. Moves are evaluated incrementally
+ * from per-row and per-column value counts.
+ *
+ * Being incomplete it cannot prove that a board has no solution: it gives up
+ * when its time budget runs out and returns the best board it has seen.
+ */
+class LocalSearch {
+public:
+  size_t iterations;
+  double seconds;
+  size_t bestCost;
+  // Conflict count sampled every curveStep iterations.
+  vector<size_t> curve;
+  size_t curveStep;
+
+  LocalSearch(const Sudoku& s, unsigned seed = 0)
+      : iterations(0)
+      , seconds(0)
+      , curveStep(1000)
+      , N(s.dimension())
+      , values(N, vector<int>(N, 0))
+      , fixed(N, vector<bool>(N, false))
+      , rowCount(N, vector<size_t>(N + 1, 0))
+      , colCount(N, vector<size_t>(N + 1, 0))
+      , boxes(N)
+      , rng(seed) {
+    for (size_t r = 0; r < N; r++)
+      for (size_t c = 0; c < N; c++)
+        if (s.solvedCell(r, c)) {
+          values[r][c] = s.valueCell(r, c);
+          fixed[r][c] = true;
+        }
+
+    // Fill every box with its missing values, giving each free cell one of
+    // its remaining candidates when possible, most constrained cells first.
+    for (size_t b = 0; b < N; b++) {
+      Sudoku::Cell missing;
+      for (int v = 1; v <= int(N); v++) missing.insert(v);
+      for (const auto& c : s.units()[3 * b + 2]) {
+        if (fixed[c.first][c.second])
+          missing.erase(values[c.first][c.second]);
+        else
+          boxes[b].push_back(c);
+      }
+      vector<Coordinate> order(boxes[b]);
+      std::sort(order.begin(), order.end(),
+                [&s](const Coordinate& x, const Coordinate& y) {
+                  return s.cellAt(x).size() < s.cellAt(y).size();
+                });
+      for (const auto& c : order) {
+        int v = *missing.begin();
+        for (int u : s.cellAt(c))
+          if (missing.count(u)) {
+            v = u;
+            break;
+          }
+        values[c.first][c.second] = v;
+        missing.erase(v);
+      }
+    }
+
+    for (size_t r = 0; r < N; r++)
+      for (size_t c = 0; c < N; c++) {
+        rowCount[r][values[r][c]]++;
+        colCount[c][values[r][c]]++;
+      }
+    cost = 0;
+    for (size_t k = 0; k < N; k++)
+      for (int v = 1; v <= int(N); v++) {
+        if (rowCount[k][v] > 1) cost += rowCount[k][v] - 1;
+        if (colCount[k][v] > 1) cost += colCount[k][v] - 1;
+      }
+    bestCost = cost;
+  }
+
+  /**
+   * Anneals for at most budget seconds. Returns the best board found and
+   * whether it is a solution.
+   */
+  pair<Sudoku, bool> solve(double budget,
+                           const CancellationToken* c = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    vector<vector<int>> best(values);
+
+    const double initialTemperature = 0.3;
+    const double cooling = 0.995;
+    const size_t patience = 2000;
+    size_t chain = 0;
+    for (const auto& box : boxes) chain += box.size();
+    chain = std::max<size_t>(chain, 1);
+
+    double temperature = initialTemperature;
+    size_t sinceImprovement = 0;
+    std::uniform_real_distribution<double> unit(0, 1);
+    while (cost > 0) {
+      if (iterations % 1024 == 0 &&
+          ((c != nullptr && c->cancelled()) ||
+           std::chrono::duration<double>(Clock::now() - start).count() >
+               budget))
+        break;
+      if (iterations % curveStep == 0) curve.push_back(cost);
+      iterations++;
+
+      const auto& box = boxes[rng() % N];
+      if (box.size() < 2) continue;
+      const Coordinate& a = box[rng() % box.size()];
+      const Coordinate& b = box[rng() % box.size()];
+      if (a == b) continue;
+
+      int delta = swapDelta(a, b);
+      if (delta <= 0 || unit(rng) < std::exp(-delta / temperature)) {
+        swap(a, b);
+        cost += delta;
+        if (cost < bestCost) {
+          bestCost = cost;
+          best = values;
+          sinceImprovement = 0;
+        }
+      }
+
+      if (iterations % chain == 0) {
+        temperature *= cooling;
+        // Stuck in a local minimum: heat up again.
+        if (++sinceImprovement > patience) {
+          temperature = initialTemperature;
+          sinceImprovement = 0;
+        }
+      }
+    }
+    curve.push_back(cost);
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return {Sudoku(best), bestCost == 0};
+  }
+
+  void print() const {
+    fmt::print_colored(
+        fmt::GREEN, "Iterations: {}\t Seconds: {:.3f}\t Iterations/s: {:.0f}\t "
+                    "Conflicts: {}\n",
+        iterations, seconds, seconds > 0 ? iterations / seconds : 0.0,
+        bestCost);
+    fmt::print("Conflict curve (every {} iterations):", curveStep);
+    // Print at most 20 evenly spaced samples.
+    size_t step = std::max<size_t>(curve.size() / 20, 1);
+    for (size_t k = 0; k < curve.size(); k += step) fmt::print(" {}", curve[k]);
+    fmt::print("\n");
+  }
+
+private:
+  size_t N;
+  vector<vector<int>> values;
+  vector<vector<bool>> fixed;
+  // rowCount[r][v] is the number of cells of row r holding v.
+  vector<vector<size_t>> rowCount;
+  vector<vector<size_t>> colCount;
+  // Free cells of every box.
+  vector<vector<Coordinate>> boxes;
+  size_t cost;
+  std::mt19937 rng;
+
+  /**
+   * Change in the conflicts of a line when out leaves it and in enters it.
+   */
+  static int lineDelta(const vector<size_t>& count, int out, int in) {
+    return (count[in] >= 1 ? 1 : 0) - (count[out] >= 2 ? 1 : 0);
+  }
+
+  int swapDelta(const Coordinate& a, const Coordinate& b) const {
+    int va = values[a.first][a.second];
+    int vb = values[b.first][b.second];
+    int delta = 0;
+    if (a.first != b.first)
+      delta += lineDelta(rowCount[a.first], va, vb) +
+               lineDelta(rowCount[b.first], vb, va);
+    if (a.second != b.second)
+      delta += lineDelta(colCount[a.second], va, vb) +
+               lineDelta(colCount[b.second], vb, va);
+    return delta;
+  }
+
+  void swap(const Coordinate& a, const Coordinate& b) {
+    int va = values[a.first][a.second];
+    int vb = values[b.first][b.second];
+    rowCount[a.first][va]--;
+    rowCount[a.first][vb]++;
+    rowCount[b.first][vb]--;
+    rowCount[b.first][va]++;
+    colCount[a.second][va]--;
+    colCount[a.second][vb]++;
+    colCount[b.second][vb]--;
+    colCount[b.second][va]++;
+    std::swap(values[a.first][a.second], values[b.first][b.second]);
+  }
+};
+
+/**
+ * Prints the outcome of a search that did not find a solution.
+ */
+void printFailure(const SearchResult& result) {
+  if (result.status == Status::OutOfBudget) {
+    print("Budget exhausted, most propagated board:\n");
+    result.board.print();
   } else {
     print("No solution found\n");
   }
-  st.print();
 }
 
-void solveAll(const Sudoku& s) {
-  Statistics st;
+/**
+ * A result of the bit-sliced engine as a SearchResult.
+ */
+SearchResult fromLanes(const BitSlicedSolver::Result& r) {
+  SearchResult result{Status::Unsolvable, Sudoku::fromGrid(r.grid),
+                      Statistics()};
+  if (r.outcome == BitSlicedSolver::Solved) {
+    result.status = Status::Solved;
+    result.stats.solutions = 1;
+  } else if (r.outcome == BitSlicedSolver::OutOfBudget) {
+    result.status = Status::OutOfBudget;
+  }
+  result.stats.decisions = r.decisions;
+  result.stats.failures = r.failures;
+  result.stats.reductions = r.rounds;
+  return result;
+}
+
+/**
+ * Runs the engine of options on s within budget, which also runs out once c
+ * is cancelled.
+ */
+pair<Sudoku, bool> search(const Sudoku& s, Statistics& st,
+                          const SolverOptions& options, Budget& budget,
+                          const CancellationToken* c = nullptr) {
+  budget.watch(c);
+  Propagation p(options.level, options.autoThreshold,
+                options.propagationThreads);
   Sudoku root(s);
-  vector<Sudoku> sols = solveAll(root, st);
-  for (const auto& s : sols) s.print();
+  pair<Sudoku, bool> sol;
+  switch (options.engine) {
+  case Engine::Backtracking:
+    if (options.restarts)
+      sol = solveWithRestarts(root, st, p, options.seed, options.restartUnit,
+                              &budget);
+    else if (options.threads > 1)
+      sol = solveParallel(root, st, p, options, budget);
+    else
+      sol = solveOne(root, st, p, nullptr, &budget);
+    break;
+  case Engine::Backjumping:
+    // Larger boards do not fit the conflict sets: search them chronologically.
+    if (root.dimension() <= ConflictSearch::maxDimension) {
+      sol = ConflictSearch(root, options.level).solve(st, &budget);
+      budget.offer(sol.first);
+    } else {
+      sol = solveOne(root, st, p, nullptr, &budget);
+    }
+    break;
+  case Engine::Sat:
+    root.reduce(p.next(), p.team.get());
+    st.reductions++;
+    budget.offer(root);
+    sol = solveSat(root, st, &budget);
+    break;
+  case Engine::LocalSearch: {
+    root.reduce(p.next(), p.team.get());
+    st.reductions++;
+    LocalSearch local(root, options.seed);
+    double seconds = options.localSearchSeconds;
+    if (options.timeLimit > 0) seconds = std::min(seconds, options.timeLimit);
+    sol = local.solve(seconds, c);
+    if (sol.second) st.solutions++;
+    if (!options.quiet) local.print();
+    // The best assignment found is the partial result of a local search.
+    if (!sol.second) {
+      budget.exhaust();
+      budget.offer(sol.first);
+    }
+    break;
+  }
+  case Engine::BitSliced:
+    // A single lane of it, which the budget stops like any other search.
+    // Boards it cannot take are searched as usual.
+    if (root.dimension() == 9 && root.isClueBoard()) {
+      BitSlicedSolver lanes;
+      lanes.stopWhen([&st, &budget](const BitSlicedSolver::Result& lane) {
+        Statistics spent = st;
+        spent.decisions += lane.decisions;
+        spent.reductions += lane.rounds;
+        return budget.exhausted(spent);
+      });
+      SearchResult r = fromLanes(lanes.solve({root.grid()})[0]);
+      st += r.stats;
+      sol = {r.board, r.status == Status::Solved};
+      if (r.status == Status::OutOfBudget) budget.exhaust();
+      budget.offer(r.board);
+    } else {
+      sol = solveOne(root, st, p, nullptr, &budget);
+    }
+    break;
+  }
+
+  return sol;
+}
+
+/**
+ * search with its outcome as a SearchResult, without the caches and without
+ * printing anything.
+ */
+SearchResult solveQuietly(const Sudoku& s, const SolverOptions& options,
+                          const CancellationToken* c = nullptr) {
+  if (!options.quiet) {
+    SolverOptions quiet(options);
+    quiet.quiet = true;
+    return solveQuietly(s, quiet, c);
+  }
+  SearchResult result{Status::Unsolvable, s, Statistics()};
+  Budget budget = options.budget();
+  pair<Sudoku, bool> sol = search(s, result.stats, options, budget, c);
+  if (sol.second) {
+    result.status = Status::Solved;
+    result.board = sol.first;
+  } else if (budget.out()) {
+    result.status = Status::OutOfBudget;
+    if (budget.hasBest()) result.board = budget.best();
+  }
+  return result;
+}
+
+SearchResult solve(const Sudoku& s,
+                   const SolverOptions& options = SolverOptions()) {
+  SearchResult result{Status::Unsolvable, s, Statistics()};
+  Statistics& st = result.stats;
+  Budget budget = options.budget();
+  if (options.cache != nullptr && options.cache->lookup(s, result.board)) {
+    result.status = Status::Solved;
+    result.board.print();
+    st.print();
+    return result;
+  }
+  bool known = options.rejects != nullptr && s.isClueBoard();
+  if (known && options.rejects->lookup(s.grid()) == NegativeCache::Unsolvable) {
+    print("Known to have no solution\n");
+    st.print();
+    return result;
+  }
+  bool stored = options.database != nullptr && s.isClueBoard();
+  SolutionDatabase::Record record;
+  if (stored && options.database->find(s.grid(), record)) {
+    result.status = Status::Solved;
+    result.board = Sudoku::fromGrid(record.solution);
+    if (options.cache != nullptr) options.cache->insert(s, result.board);
+    result.board.print();
+    print("From the database, solved with {} decisions and {} failures\n",
+          record.decisions, record.failures);
+    st.print();
+    return result;
+  }
+  pair<Sudoku, bool> sol = search(s, st, options, budget);
+  if (sol.second) {
+    result.status = Status::Solved;
+    result.board = sol.first;
+    if (options.cache != nullptr) options.cache->insert(s, sol.first);
+    if (stored)
+      options.database->insert(s.grid(),
+                               {sol.first.grid(), st.decisions, st.failures});
+    sol.first.print();
+  } else {
+    if (budget.out()) {
+      result.status = Status::OutOfBudget;
+      if (budget.hasBest()) result.board = budget.best();
+    }
+    // Only a search run to the end proves there is no solution.
+    if (known && result.status == Status::Unsolvable)
+      options.rejects->insert(s.grid(), NegativeCache::Unsolvable);
+    printFailure(result);
+  }
   st.print();
+  return result;
+}
+
+/**
+ * A configuration of the solver, and the name to report it by.
+ */
+struct Strategy {
+  std::string name;
+  SolverOptions options;
+};
+
+/**
+ * Races several strategies on the same puzzle, each in its own thread, and
+ * keeps the first conclusive result: a solution, or the proof that there is
+ * none. That cancels the others. The wins of every strategy are counted
+ * across the puzzles solved, which tells the best default for a corpus.
+ */
+class Portfolio {
+public:
+  // Index of the strategy that won the last puzzle, size() if none did.
+  size_t winner;
+
+  explicit Portfolio(const vector<Strategy>& strategies = defaults())
+      : winner(strategies.size())
+      , strategies(strategies)
+      , wins(strategies.size(), 0)
+      , undecided(0) {}
+
+  /**
+   * Strategies that differ in engine, propagation and branching. The bit
+   * sliced one only races on 9x9 boards of clues, see solve.
+   */
+  static vector<Strategy> defaults() {
+    vector<Strategy> all(7);
+    all[0].name = "backtracking";
+    all[1].name = "hidden singles";
+    all[1].options.level = PropagationLevel::HiddenSingles;
+    all[2].name = "probing";
+    all[2].options.level = PropagationLevel::Probing;
+    all[3].name = "restarts";
+    all[3].options.restarts = true;
+    all[3].options.seed = 1;
+    all[4].name = "backjumping";
+    all[4].options.engine = Engine::Backjumping;
+    all[5].name = "sat";
+    all[5].options.engine = Engine::Sat;
+    all[6].name = "bit sliced";
+    all[6].options.engine = Engine::BitSliced;
+    return all;
+  }
+
+  size_t size() const { return strategies.size(); }
+  const Strategy& strategy(size_t i) const { return strategies[i]; }
+
+  /**
+   * The result of the winner. When no strategy is conclusive within its
+   * budget, that of the first one.
+   *
+   * The bit sliced engine falls back to plain backtracking on the boards it
+   * cannot take, so it does not race on them: it would only repeat the first
+   * strategy.
+   */
+  SearchResult solve(const Sudoku& s) {
+    CancellationToken cancel;
+    std::mutex lock;
+    vector<SearchResult> results(size(),
+                                 {Status::Unsolvable, s, Statistics()});
+    winner = size();
+    bool sliceable = s.dimension() == 9 && s.isClueBoard();
+    vector<std::thread> threads;
+    for (size_t i = 0; i < size(); i++) {
+      if (strategies[i].options.engine == Engine::BitSliced && !sliceable)
+        continue;
+      threads.emplace_back([this, i, &s, &cancel, &lock, &results] {
+        results[i] = solveQuietly(s, strategies[i].options, &cancel);
+        // Cut short by its budget or by the winner.
+        if (results[i].status == Status::OutOfBudget) return;
+        std::lock_guard<std::mutex> guard(lock);
+        if (winner == size()) {
+          winner = i;
+          cancel.cancel();
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+
+    if (winner == size()) {
+      undecided++;
+      return results[0];
+    }
+    wins[winner]++;
+    return results[winner];
+  }
+
+  void print() const {
+    for (size_t i = 0; i < size(); i++)
+      fmt::print("{}: {} wins\n", strategies[i].name, wins[i]);
+    if (undecided > 0) fmt::print("Undecided: {}\n", undecided);
+  }
+
+private:
+  vector<Strategy> strategies;
+  vector<size_t> wins;
+  size_t undecided;
+};
+
+/**
+ * Streams the solutions of s to visit, see SolutionVisitor. The board of the
+ * result is the first solution.
+ */
+SearchResult solveAll(const Sudoku& s, const SolutionVisitor& visit,
+                      const SolverOptions& options = SolverOptions()) {
+  if (options.threads > 1) return ParallelSolveAll(visit, options).run(s);
+  SearchResult result{Status::Unsolvable, s, Statistics()};
+  Budget budget = options.budget();
+  Propagation p(options.level, options.autoThreshold,
+                options.propagationThreads);
+  Checkpoint checkpoint(s, options.checkpointFile, options.checkpointInterval);
+  Checkpoint* cp = nullptr;
+  if (!options.checkpointFile.empty()) {
+    cp = &checkpoint;
+    if (options.resume && checkpoint.load(result.stats, p)) {
+      // The limits of the budget apply to this run only.
+      const Statistics& st = result.stats;
+      budget = Budget(
+          options.maxNodes == 0 ? 0 : options.maxNodes + st.decisions,
+          options.maxReductions == 0 ? 0 : options.maxReductions + st.reductions,
+          options.timeLimit);
+    } else if (options.resume) {
+      print("No checkpoint of this board in {}, starting over\n",
+            options.checkpointFile);
+    }
+  }
+  size_t before = result.stats.solutions;
+  Sudoku root(s);
+  bool complete = solveAll(root, result.stats, p, [&](const Sudoku& sol) {
+    if (result.stats.solutions == before + 1) result.board = sol;
+    return visit(sol);
+  }, &budget, cp);
+  // Only a run cut short by its budget (or killed) leaves a checkpoint.
+  if (cp != nullptr && !budget.out()) checkpoint.remove();
+
+  if (budget.out()) {
+    result.status = Status::OutOfBudget;
+    if (result.stats.solutions == 0 && budget.hasBest())
+      result.board = budget.best();
+  } else if (!complete) {
+    result.status = Status::Stopped;
+  } else if (result.stats.solutions > 0) {
+    result.status = Status::Solved;
+  }
+  return result;
+}
+
+SearchResult solveAll(const Sudoku& s,
+                      const SolverOptions& options = SolverOptions()) {
+  SearchResult result = solveAll(s, [](const Sudoku& sol) {
+    sol.print();
+    return true;
+  }, options);
+  if (result.status == Status::OutOfBudget) printFailure(result);
+  result.stats.print();
+  return result;
+}
+
+// The characters of the values on one line: 1-9, then A-Z, then a-z. They
+// reach 61, enough for boards up to 49x49.
+const char puzzleDigits[] =
+    "123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+enum { maxPuzzleValue = sizeof(puzzleDigits) - 1 };
+
+/**
+ * Reads a puzzle written on one line, row by row: puzzleDigits for the
+ * values, 0 or . for the empty cells. Returns false if the line is not a
+ * board of a supported size, which is at most 49x49.
+ */
+bool parsePuzzle(const std::string& line, vector<int>& grid) {
+  grid.clear();
+  for (char ch : line) {
+    if (ch == '.' || ch == '0')
+      grid.push_back(0);
+    else if (ch >= '1' && ch <= '9')
+      grid.push_back(ch - '0');
+    else if (ch >= 'A' && ch <= 'Z')
+      grid.push_back(ch - 'A' + 10);
+    else if (ch >= 'a' && ch <= 'z')
+      grid.push_back(ch - 'a' + 36);
+    else if (!std::isspace(static_cast<unsigned char>(ch)))
+      return false;
+  }
+  size_t n = 2;
+  while (n * n * n * n < grid.size()) n++;
+  if (n * n * n * n != grid.size() || n * n > maxPuzzleValue) return false;
+  for (int v : grid)
+    if (v > int(n * n)) return false;
+  return true;
+}
+
+/**
+ * Writes grid on one line, as parsePuzzle reads it. Returns false, writing
+ * nothing, if a value has no character, on boards larger than 49x49.
+ */
+bool formatPuzzle(const vector<int>& grid, fmt::MemoryWriter& out) {
+  for (int v : grid)
+    if (v < 0 || v > maxPuzzleValue) return false;
+  for (int v : grid) out << (v == 0 ? '.' : puzzleDigits[v - 1]);
+  return true;
+}
+
+const char* statusName(Status status) {
+  switch (status) {
+  case Status::Solved:
+    return "Solved";
+  case Status::Unsolvable:
+    return "Unsolvable";
+  case Status::Stopped:
+    return "Stopped";
+  case Status::OutOfBudget:
+    return "OutOfBudget";
+  }
+  return "";
+}
+
+/**
+ * Solves files of puzzles, one per line. For every puzzle it writes a line
+ * with its board (the solution, or the most propagated board) and its status,
+ * in the order of the input.
+ *
+ * The work is a pipeline of stages: read, parse, solve, format and write,
+ * each on its own threads (options.threads of them to solve) and connected by
+ * lock-free queues. What goes through the pipeline are jobs, chunks of
+ * consecutive puzzles whose buffers are recycled: the writer hands them back
+ * to the reader once written. A slow writer thus only stalls the solvers once
+ * every job is waiting for it. The writer puts the jobs back in order.
+ */
+class BatchSolver {
+public:
+  BatchSolver(const SolverOptions& options, size_t parsers = 1,
+              size_t formatters = 1)
+      : options(options)
+      , in(nullptr)
+      , out(nullptr)
+      , nextWrite(0)
+      , puzzles(0)
+      , invalid(0)
+      , counts(4, 0)
+      , seconds(0) {
+    // The threads solve different puzzles, each one sequentially and without
+    // printing anything.
+    this->options.threads = 1;
+    this->options.quiet = true;
+    const char* names[] = {"Read", "Parse", "Solve", "Format", "Write"};
+    size_t threads[] = {1, parsers, options.threads, formatters, 1};
+    size_t total = 0;
+    for (size_t i = 0; i < stageCount; i++) {
+      stages[i].name = names[i];
+      stages[i].threads = std::max<size_t>(threads[i], 1);
+      total += stages[i].threads;
+    }
+    for (size_t i = 0; i < jobsPerThread * total; i++) {
+      jobs.emplace_back(new Job());
+      jobs.back()->entries.resize(chunkSize);
+    }
+    // Every queue can hold every job and the end marks.
+    for (Stage& stage : stages)
+      stage.input.reset(new BoundedQueue<Job*>(jobs.size() + total));
+  }
+
+  /**
+   * Solves the puzzles of input and writes their results to output. Empty
+   * lines and lines starting with # are skipped.
+   */
+  bool run(std::istream& input, std::ostream& output) {
+    in = &input;
+    out = &output;
+    Clock::time_point start = Clock::now();
+    for (const std::unique_ptr<Job>& job : jobs) push(Read, job.get());
+    // Pinned solvers take the first CPUs of the placement, and the lighter
+    // stages the next ones. The reader is the calling thread, never pinned.
+    vector<Topology::Cpu> cpus;
+    if (options.pinThreads) {
+      size_t total = 0;
+      for (size_t i = Parse; i < stageCount; i++) total += stages[i].threads;
+      cpus = Topology::system().placement(total);
+    }
+    vector<std::thread> threads;
+    for (size_t i : {Solve, Parse, Format, Write})
+      for (size_t t = 0; t < stages[i].threads; t++) {
+        bool pin = threads.size() < cpus.size();
+        unsigned cpu = pin ? cpus[threads.size()].id : 0;
+        threads.emplace_back([this, i, pin, cpu] {
+          if (pin) Topology::pin(cpu);
+          work(i);
+        });
+      }
+    work(Read);
+    for (std::thread& t : threads) t.join();
+
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::sort(latencies.begin(), latencies.end());
+    out->flush();
+    return bool(*out);
+  }
+
+  /**
+   * Puzzles per second of the last run.
+   */
+  double throughput() const { return seconds > 0 ? puzzles / seconds : 0; }
+
+  void print() const {
+    fmt::print("Puzzles: {}\t Solved: {}\t Unsolvable: {}\t Out of budget: "
+               "{}\t Invalid: {}\n",
+               puzzles, counts[static_cast<int>(Status::Solved)],
+               counts[static_cast<int>(Status::Unsolvable)],
+               counts[static_cast<int>(Status::OutOfBudget)], invalid);
+    fmt::print_colored(fmt::GREEN,
+                       "Seconds: {:.3f}\t Puzzles/s: {:.0f}\t Nodes: {}\n",
+                       seconds, seconds > 0 ? puzzles / seconds : 0.0,
+                       total.decisions);
+    // Busy is the share of the time of the threads of a stage spent working,
+    // and depth the mean length of its input queue when it takes a job.
+    for (const Stage& s : stages) {
+      double time = seconds * s.threads * 1e9;
+      fmt::print("{}: {} threads\t Busy: {:.1f}%\t Waiting: {:.1f}%\t Depth: "
+                 "{:.1f} of {}\n",
+                 s.name, s.threads, time > 0 ? 100 * s.busy / time : 0.0,
+                 time > 0 ? 100 * s.idle / time : 0.0,
+                 s.samples > 0 ? double(s.depth) / s.samples : 0.0,
+                 jobs.size());
+    }
+    if (latencies.empty()) return;
+    double sum = 0;
+    for (double l : latencies) sum += l;
+    fmt::print_colored(fmt::GREEN,
+                       "Latency (us): mean {:.1f}\t p50 {:.1f}\t p90 {:.1f}\t "
+                       "p99 {:.1f}\t p99.9 {:.1f}\t max {:.1f}\n",
+                       sum / latencies.size(), percentile(0.5),
+                       percentile(0.9), percentile(0.99), percentile(0.999),
+                       latencies.back());
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  enum StageIndex { Read, Parse, Solve, Format, Write, stageCount };
+  enum { chunkSize = 32, jobsPerThread = 4 };
+
+  struct Entry {
+    std::string line;
+    vector<int> grid;
+    bool valid;
+    // Solved together with the others of its job, by the bit-sliced engine.
+    bool grouped;
+    Status status;
+    Statistics stats;
+    double micros;
+  };
+
+  struct Job {
+    size_t sequence;
+    // Entries in use, the others are buffers kept for later.
+    size_t size;
+    vector<Entry> entries;
+    fmt::MemoryWriter text;
+  };
+
+  struct Stage {
+    const char* name;
+    size_t threads;
+    std::unique_ptr<BoundedQueue<Job*>> input;
+    // Threads still running, the last one closes the next stage.
+    std::atomic<size_t> running;
+    std::mutex lock;
+    // Nanoseconds working and waiting for jobs, and the input depth summed
+    // over samples.
+    uint64_t busy;
+    uint64_t idle;
+    uint64_t depth;
+    uint64_t samples;
+
+    Stage()
+        : threads(1)
+        , running(0)
+        , busy(0)
+        , idle(0)
+        , depth(0)
+        , samples(0) {}
+  };
+
+  SolverOptions options;
+  Stage stages[stageCount];
+  vector<std::unique_ptr<Job>> jobs;
+  std::istream* in;
+  std::ostream* out;
+  // Jobs done but waiting for an earlier one, and the next one to write.
+  std::map<size_t, Job*> pending;
+  size_t nextWrite;
+  size_t puzzles;
+  size_t invalid;
+  // Puzzles by status.
+  vector<size_t> counts;
+  Statistics total;
+  double seconds;
+  // Microseconds solving every puzzle, sorted once the run is over.
+  vector<double> latencies;
+
+  static uint64_t nanos(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  /**
+   * The loop of every thread of stage i: take a job, process it, pass it on.
+   * A null job is the end mark, sent once the previous stage is done.
+   */
+  void work(size_t i) {
+    Stage& stage = stages[i];
+    if (i == Read) stage.running = 1;
+    uint64_t busy = 0, idle = 0, depth = 0, samples = 0;
+    size_t sequence = 0;
+    while (true) {
+      Clock::time_point start = Clock::now();
+      depth += stage.input->size();
+      samples++;
+      Job* job;
+      for (size_t spins = 0; !stage.input->pop(job); spins++) backoff(spins);
+      Clock::time_point taken = Clock::now();
+      idle += nanos(taken - start);
+      if (job == nullptr) break;
+
+      if (i == Read) job->sequence = sequence++;
+      process(i, *job);
+      busy += nanos(Clock::now() - taken);
+      // The reader stops at the end of the input.
+      if (i == Read && job->size == 0) break;
+      if (i != Write) push(i + 1, job);
+    }
+
+    std::lock_guard<std::mutex> guard(stage.lock);
+    stage.busy += busy;
+    stage.idle += idle;
+    stage.depth += depth;
+    stage.samples += samples;
+    if (--stage.running == 0 && i + 1 < stageCount) {
+      stages[i + 1].running = stages[i + 1].threads;
+      for (size_t t = 0; t < stages[i + 1].threads; t++) push(i + 1, nullptr);
+    }
+  }
+
+  void push(size_t i, Job* job) {
+    for (size_t spins = 0; !stages[i].input->push(job); spins++) backoff(spins);
+  }
+
+  /**
+   * Waits for a queue: spins first, then sleeps a little so that idle stages
+   * leave the cores to the busy ones.
+   */
+  static void backoff(size_t spins) {
+    if (spins < 64)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+
+  void process(size_t i, Job& job) {
+    switch (i) {
+    case Read:
+      job.size = 0;
+      while (job.size < chunkSize &&
+             std::getline(*in, job.entries[job.size].line)) {
+        const std::string& line = job.entries[job.size].line;
+        if (!line.empty() && line[0] != '#') job.size++;
+      }
+      break;
+    case Parse:
+      for (size_t k = 0; k < job.size; k++) {
+        Entry& e = job.entries[k];
+        e.valid = parsePuzzle(e.line, e.grid);
+        e.grouped = false;
+      }
+      break;
+    case Solve:
+      if (options.engine == Engine::BitSliced)
+        solveLanes(job);
+      for (size_t k = 0; k < job.size; k++) {
+        Entry& e = job.entries[k];
+        if (!e.valid || e.grouped) continue;
+        Clock::time_point start = Clock::now();
+        SearchResult r = solveQuietly(Sudoku::fromGrid(e.grid), options);
+        e.status = r.status;
+        e.stats = r.stats;
+        e.grid = r.board.grid();
+        e.micros =
+            std::chrono::duration<double, std::micro>(Clock::now() - start)
+                .count();
+      }
+      break;
+    case Format:
+      job.text.clear();
+      for (size_t k = 0; k < job.size; k++) {
+        const Entry& e = job.entries[k];
+        // Parsed boards always have a character for each value.
+        if (!e.valid || !formatPuzzle(e.grid, job.text)) job.text << e.line;
+        job.text << ' ' << (e.valid ? statusName(e.status) : "Invalid")
+                 << '\n';
+      }
+      break;
+    case Write:
+      pending[job.sequence] = &job;
+      while (!pending.empty() && pending.begin()->first == nextWrite) {
+        Job* next = pending.begin()->second;
+        pending.erase(pending.begin());
+        nextWrite++;
+        write(*next);
+        push(Read, next);
+      }
+      break;
+    }
+  }
+
+  /**
+   * Solves the 9x9 puzzles of job together on the bit-sliced engine, and
+   * marks them as grouped.
+   */
+  void solveLanes(Job& job) {
+    vector<vector<int>> puzzles;
+    vector<size_t> index;
+    for (size_t k = 0; k < job.size; k++) {
+      Entry& e = job.entries[k];
+      e.grouped = e.valid && e.grid.size() == 81;
+      if (!e.grouped) continue;
+      puzzles.push_back(e.grid);
+      index.push_back(k);
+    }
+    BitSlicedSolver lanes(options.maxNodes);
+    vector<BitSlicedSolver::Result> results = lanes.solve(puzzles);
+    for (size_t i = 0; i < results.size(); i++) {
+      Entry& e = job.entries[index[i]];
+      SearchResult r = fromLanes(results[i]);
+      e.status = r.status;
+      e.stats = r.stats;
+      e.grid = results[i].grid;
+      e.micros = results[i].micros;
+    }
+  }
+
+  void write(const Job& job) {
+    out->write(job.text.data(), job.text.size());
+    for (size_t k = 0; k < job.size; k++) {
+      const Entry& e = job.entries[k];
+      puzzles++;
+      if (!e.valid) {
+        invalid++;
+        continue;
+      }
+      latencies.push_back(e.micros);
+      counts[static_cast<int>(e.status)]++;
+      total += e.stats;
+    }
+  }
+
+  double percentile(double q) const {
+    return latencies[std::min<size_t>(q * latencies.size(),
+                                      latencies.size() - 1)];
+  }
+};
+
+/**
+ * Runs the batch of puzzles in text with 1, 2, 4... solvers up to
+ * maxThreads, with free and with pinned threads, and prints the throughput
+ * of each run and its speedup over a single solver.
+ */
+void scalingBenchmark(const std::string& text, size_t maxThreads) {
+  const Topology& topology = Topology::system();
+  fmt::print("CPUs: {}\t Cores: {}\t NUMA nodes: {}\n", topology.cpus().size(),
+             topology.cores(), topology.nodes());
+  vector<size_t> counts;
+  for (size_t t = 1; t < maxThreads; t *= 2) counts.push_back(t);
+  counts.push_back(std::max<size_t>(maxThreads, 1));
+  for (bool pinned : {false, true}) {
+    double base = 0;
+    for (size_t threads : counts) {
+      SolverOptions options;
+      options.engine = Engine::BitSliced;
+      options.threads = threads;
+      options.pinThreads = pinned;
+      std::istringstream in(text);
+      std::ostringstream out;
+      BatchSolver batch(options);
+      batch.run(in, out);
+      if (threads == 1) base = batch.throughput();
+      fmt::print("{}: {} solvers\t Puzzles/s: {:.0f}\t Speedup: {:.2f}\n",
+                 pinned ? "Pinned" : "Free", threads, batch.throughput(),
+                 base > 0 ? batch.throughput() / base : 0.0);
+    }
+  }
 }
 
-int main(void) {
+// The tests include this file and bring their own main.
+#ifndef SUDOKU_NO_MAIN
+int main(int argc, char** argv) {
+  if (argc >= 3 && std::string(argv[1]) == "--scaling") {
+    // Scaling benchmark: sudoku --scaling <puzzles> [max solvers]
+    std::ifstream in(argv[2]);
+    if (!in) {
+      fmt::print("Cannot open {}\n", argv[2]);
+      return 1;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    scalingBenchmark(text.str(), argc > 3
+                                     ? std::atoi(argv[3])
+                                     : std::thread::hardware_concurrency());
+    return 0;
+  }
+  if (argc >= 3) {
+    // Batch mode: sudoku <puzzles> <results> [solvers [parsers [formatters]]]
+    SolverOptions options;
+    // Lanes of 9x9 puzzles, the others one at a time.
+    options.engine = Engine::BitSliced;
+    options.threads = argc > 3 ? std::atoi(argv[3])
+                               : std::thread::hardware_concurrency();
+    size_t parsers = argc > 4 ? std::atoi(argv[4]) : 1;
+    size_t formatters = argc > 5 ? std::atoi(argv[5]) : 1;
+    std::ifstream in(argv[1]);
+    std::ofstream out(argv[2]);
+    if (!in || !out) {
+      fmt::print("Cannot open {} or {}\n", argv[1], argv[2]);
+      return 1;
+    }
+    BatchSolver batch(options, parsers, formatters);
+    bool ok = batch.run(in, out);
+    batch.print();
+    return ok ? 0 : 1;
+  }
+
   fmt::print("Sudoku solver\n");
   Sudoku a({{0, 0, 3, 0, 2, 0, 6, 0, 0},
             {9, 0, 0, 3, 0, 5, 0, 0, 1},
@@ -378,4 +3830,5 @@ int main(void) {
   solveAll(e);
   // solve(d);
   return 0;
-}
\ No newline at end of file
+}
+#endif  // SUDOKU_NO_MAIN
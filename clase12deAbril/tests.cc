@@ -0,0 +1,664 @@
+// Checks of the solver against independent ways of getting the same answer.
+// Build and run with make check.
+#define SUDOKU_NO_MAIN
+#include "sudoku.cc"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+size_t failures = 0;
+
+void check(bool ok, const std::string& what) {
+  if (ok) return;
+  failures++;
+  fmt::print_colored(fmt::RED, "FAILED: {}\n", what);
+}
+
+Sudoku board(const std::string& line) {
+  vector<int> grid;
+  parsePuzzle(line, grid);
+  return Sudoku::fromGrid(grid);
+}
+
+// Puzzles with one solution, several and none, on 9x9 and 4x4 boards. Only
+// the easy ones are given to local search, which cannot prove anything.
+struct Puzzle {
+  const char* line;
+  bool easy;
+};
+const Puzzle puzzles[] = {
+    {"003020600900305001001806400008102900700000008006708200002609500800203009"
+     "005010300", true},
+    {"200080300060070084030500209000105408000000000402706000301007040720040060"
+     "004010003", false},
+    {"000000907000420180000705026100904000050000040000507009920108000034059000"
+     "507000000", false},
+    {"003020600000300001001806400008102900700000008006708200002600500800203009"
+     "005010300", false},
+    {"003020000900305001001806000008100900700000008006708200002609500000200009"
+     "005010300", false},
+    {"800000000003605000070090200050007000000045700000100030001000068008500010"
+     "090000400", false},
+    {"1200340000000000", true},
+    {"1200210000000000", true},
+};
+
+/**
+ * Whether solution is a solved board that keeps the clues of puzzle.
+ */
+bool solves(const Sudoku& solution, const Sudoku& puzzle) {
+  if (!solution.isSolved()) return false;
+  vector<int> clues = puzzle.grid(), values = solution.grid();
+  for (size_t c = 0; c < clues.size(); c++)
+    if (clues[c] != 0 && clues[c] != values[c]) return false;
+  return true;
+}
+
+/**
+ * Solving with options agrees with countSolutions on every puzzle: a unique
+ * solution is the one found, a board with several gets one of them and a
+ * board with none gets none. An incomplete engine, which cannot prove
+ * anything, only gets the easy puzzles that have a solution.
+ */
+void agreesWithCount(const std::string& name, const SolverOptions& options,
+                     bool incomplete = false) {
+  for (const Puzzle& puzzle : puzzles) {
+    Sudoku s = board(puzzle.line);
+    SearchResult count = countSolutions(s, 2);
+    if (incomplete && (!puzzle.easy || count.status == Status::Unsolvable))
+      continue;
+    std::string what = fmt::format("{} on {}", name, puzzle.line);
+    SearchResult r = solveQuietly(s, options);
+    if (count.status == Status::Unsolvable) {
+      check(r.status == Status::Unsolvable, what + ": status");
+      continue;
+    }
+    check(r.status == Status::Solved && solves(r.board, s),
+          what + ": solution");
+    if (count.status == Status::Solved)
+      check(r.board.grid() == count.board.grid(), what + ": unique");
+  }
+}
+
+/**
+ * solveAll with options visits as many solutions as countSolutions counts,
+ * on every puzzle.
+ */
+void enumeratesAll(const std::string& name, const SolverOptions& options) {
+  for (const Puzzle& puzzle : puzzles) {
+    Sudoku s = board(puzzle.line);
+    SearchResult count = countSolutions(s, 1000);
+    size_t visited = 0;
+    SearchResult r = solveAll(s, [&visited](const Sudoku&) {
+      visited++;
+      return true;
+    }, options);
+    std::string what = fmt::format("solveAll with {} on {}", name, puzzle.line);
+    check(visited == count.stats.solutions, what + ": visited");
+    check(r.stats.solutions == count.stats.solutions, what + ": solutions");
+  }
+}
+
+/**
+ * Probing only removes candidates that lead to a contradiction, so it keeps
+ * every solution.
+ */
+void testProbing() {
+  SolverOptions options;
+  options.level = PropagationLevel::Probing;
+  agreesWithCount("probing", options);
+  enumeratesAll("probing", options);
+}
+
+bool sameCandidates(const Sudoku& a, const Sudoku& b) {
+  if (a.dimension() != b.dimension()) return false;
+  for (size_t i = 0; i < a.dimension(); i++)
+    for (size_t j = 0; j < a.dimension(); j++)
+      if (a.cellAt({i, j}) != b.cellAt({i, j})) return false;
+  return true;
+}
+
+/**
+ * Every propagation level, the automatic one included, keeps the solutions.
+ */
+void testLevels() {
+  for (PropagationLevel level :
+       {PropagationLevel::NakedSingles, PropagationLevel::HiddenSingles,
+        PropagationLevel::Subsets, PropagationLevel::Auto}) {
+    SolverOptions options;
+    options.level = level;
+    agreesWithCount(fmt::format("level {}", static_cast<int>(level)), options);
+  }
+}
+
+/**
+ * Backjumping with nogood learning keeps the solutions.
+ */
+void testBackjumping() {
+  SolverOptions options;
+  options.engine = Engine::Backjumping;
+  agreesWithCount("backjumping", options);
+}
+
+/**
+ * The SAT backend finds the solutions and proves the boards without one.
+ */
+void testSat() {
+  SolverOptions options;
+  options.engine = Engine::Sat;
+  agreesWithCount("sat", options);
+}
+
+/**
+ * Local search solves the easy puzzles. It cannot prove a board has no
+ * solution, or a single one, so it gets nothing else.
+ */
+void testLocalSearch() {
+  SolverOptions options;
+  options.engine = Engine::LocalSearch;
+  agreesWithCount("local search", options, true);
+}
+
+/**
+ * Restarts keep the search complete: the Luby schedule always grows, so a
+ * run eventually explores the whole tree.
+ */
+void testRestarts() {
+  SolverOptions options;
+  options.restarts = true;
+  options.restartUnit = 4;
+  agreesWithCount("restarts", options);
+}
+
+/**
+ * solveAll visits every solution once, and stops as soon as the visitor
+ * returns false.
+ */
+void testVisitor() {
+  SolverOptions options;
+  enumeratesAll("naked singles", options);
+  options.level = PropagationLevel::HiddenSingles;
+  enumeratesAll("hidden singles", options);
+
+  // 6 solutions: the first one stops the enumeration.
+  size_t visited = 0;
+  SearchResult r = solveAll(board(puzzles[3].line), [&visited](const Sudoku&) {
+    visited++;
+    return false;
+  });
+  check(r.status == Status::Stopped && visited == 1, "visitor stopping");
+}
+
+/**
+ * An enumeration stopped by its budget again and again, and resumed from its
+ * checkpoint every time, ends as one run from scratch does.
+ */
+void testCheckpoint() {
+  // 171 solutions, a few hundred decisions.
+  Sudoku s = board(puzzles[4].line);
+  SearchResult fresh = solveAll(s, [](const Sudoku&) { return true; });
+
+  SolverOptions options;
+  options.checkpointFile = "tests.checkpoint";
+  options.maxNodes = 20;
+  SearchResult r;
+  size_t runs = 0;
+  do {
+    r = solveAll(s, [](const Sudoku&) { return true; }, options);
+    options.resume = true;
+    runs++;
+  } while (r.status == Status::OutOfBudget && runs < 1000);
+  check(runs > 1, "checkpoint: the budget stops the enumeration");
+  check(r.status == fresh.status, "checkpoint: status");
+  check(r.stats.solutions == fresh.stats.solutions, "checkpoint: solutions");
+  check(r.stats.decisions == fresh.stats.decisions, "checkpoint: decisions");
+  check(!std::ifstream(options.checkpointFile),
+        "checkpoint: removed once complete");
+}
+
+// Entry i of the database checks: a puzzle with i written in base 9 in its
+// first cells, and a solution and work derived from i.
+vector<int> dbPuzzle(size_t i) {
+  vector<int> grid(81, 0);
+  for (size_t c = 0; c < 6; c++, i /= 9) grid[c] = 1 + i % 9;
+  return grid;
+}
+
+SolutionDatabase::Record dbRecord(size_t i) {
+  SolutionDatabase::Record r;
+  for (size_t c = 0; c < 81; c++) r.solution.push_back(1 + (i + c) % 9);
+  r.decisions = i;
+  r.failures = 2 * i;
+  return r;
+}
+
+/**
+ * The lookups of a reader in another process, while the writer inserts and
+ * grows the table, only ever see whole entries. Exits with 0 once it has
+ * seen all of them, 1 on a torn entry, 2 when no other writer should have
+ * been let in and 3 if the entries never all show up.
+ */
+void readDatabase(const std::string& path, size_t entries) {
+  SolutionDatabase writer;
+  if (writer.open(path, SolutionDatabase::ReadWrite)) _exit(2);
+  SolutionDatabase db;
+  while (!db.open(path, SolutionDatabase::ReadOnly)) usleep(1000);
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  vector<char> seen(entries, false);
+  size_t left = entries;
+  while (left > 0) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::seconds(60))
+      _exit(3);
+    for (size_t i = 0; i < entries; i++) {
+      SolutionDatabase::Record r;
+      if (!db.find(dbPuzzle(i), r)) {
+        if (seen[i]) _exit(1);
+        continue;
+      }
+      SolutionDatabase::Record expected = dbRecord(i);
+      if (r.solution != expected.solution ||
+          r.decisions != expected.decisions || r.failures != expected.failures)
+        _exit(1);
+      if (!seen[i]) {
+        seen[i] = true;
+        left--;
+      }
+    }
+  }
+  _exit(0);
+}
+
+/**
+ * A reader process looks entries up while the writer inserts them into a
+ * table that starts with 8 slots, and so is rebuilt and moved several times.
+ */
+void testSolutionDatabase() {
+  const std::string path = "tests.db";
+  const size_t entries = 2000;
+  std::remove(path.c_str());
+  SolutionDatabase db;
+  check(db.open(path, SolutionDatabase::ReadWrite, 9, 8), "database: open");
+  pid_t reader = fork();
+  if (reader == 0) readDatabase(path, entries);
+  for (size_t i = 0; i < entries; i++)
+    check(db.insert(dbPuzzle(i), dbRecord(i)),
+          fmt::format("database: insert {}", i));
+  check(!db.insert(dbPuzzle(0), dbRecord(0)), "database: insert twice");
+  check(db.size() == entries && db.capacity() > entries,
+        "database: size and growth");
+  db.flush();
+  int status = -1;
+  waitpid(reader, &status, 0);
+  check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        fmt::format("database: reader exited with {}", status));
+  db.close();
+  std::remove(path.c_str());
+  std::remove((path + ".lock").c_str());
+}
+
+/**
+ * A board the negative cache knows to have several solutions is still
+ * counted again when a witness is needed.
+ */
+void testNegativeCache() {
+  NegativeCache rejects;
+  SolverOptions options;
+  options.rejects = &rejects;
+  Sudoku s = board(puzzles[4].line);
+  for (size_t pass = 0; pass < 2; pass++) {
+    SearchResult r = countSolutions(s, 2, options);
+    std::string what = fmt::format("negative cache, pass {}", pass);
+    check(r.status == Status::Stopped, what + ": status");
+    check(solves(r.board, s), what + ": witness");
+  }
+}
+
+/**
+ * Compares a session after an edit with one built from scratch on the same
+ * clues: same propagated board, same failure, same answer of check.
+ */
+void compareWithFresh(EditSession& edited, const vector<int>& clues,
+                      const std::string& what) {
+  EditSession fresh(Sudoku::fromGrid(clues));
+  check(edited.isFailed() == fresh.isFailed(), what + ": failure");
+  if (!edited.isFailed() && !fresh.isFailed())
+    check(sameCandidates(edited.board(), fresh.board()), what + ": board");
+  Statistics st;
+  check(edited.check(st) == fresh.check(st), what + ": check");
+}
+
+void testEditSession() {
+  // Row 0 holding 1..7 leaves {8, 9} for its last two cells: the clue 8 at
+  // (0, 8) makes (0, 7) a 9, which must leave its column and box.
+  vector<int> clues(81, 0);
+  EditSession session(Sudoku::fromGrid(clues));
+  for (int v = 1; v <= 7; v++) {
+    clues[v - 1] = v;
+    session.addClue({0, size_t(v - 1)}, v);
+  }
+  clues[8] = 8;
+  session.addClue({0, 8}, 8);
+  compareWithFresh(session, clues, "addClue making a peer single");
+
+  // Values and cells off the board are rejected without touching anything.
+  check(!session.addClue({0, 8}, 0), "addClue of 0");
+  check(!session.addClue({0, 8}, 10), "addClue of 10");
+  check(!session.addClue({9, 0}, 1), "addClue off the board");
+  compareWithFresh(session, clues, "rejected addClue");
+
+  // Random edits on a few puzzles, each compared with a fresh session.
+  std::mt19937 rng(1);
+  for (size_t round = 0; round < 40; round++) {
+    clues.assign(81, 0);
+    EditSession random(Sudoku::fromGrid(clues));
+    for (size_t edit = 0; edit < 60; edit++) {
+      size_t cell = rng() % 81;
+      Coordinate c{cell / 9, cell % 9};
+      if (clues[cell] != 0 && rng() % 3 == 0) {
+        clues[cell] = 0;
+        random.removeClue(c);
+      } else {
+        clues[cell] = 1 + rng() % 9;
+        random.addClue(c, clues[cell]);
+      }
+      compareWithFresh(random, clues,
+                       fmt::format("edit {} of round {}", edit, round));
+    }
+  }
+}
+
+/**
+ * The parallel solveAll visits every solution once, and its workers share
+ * one node budget.
+ */
+void testParallelEnumeration() {
+  SolverOptions options;
+  options.threads = 3;
+  enumeratesAll("3 threads", options);
+
+  // 171 solutions take a few hundred decisions.
+  options.maxNodes = 50;
+  SearchResult r = solveAll(board(puzzles[4].line),
+                            [](const Sudoku&) { return true; }, options);
+  check(r.status == Status::OutOfBudget, "parallel solveAll budget: status");
+  // Each thread may make one decision after the last check of the budget.
+  check(r.stats.decisions >= options.maxNodes &&
+            r.stats.decisions < options.maxNodes + options.threads,
+        "parallel solveAll budget: decisions");
+}
+
+/**
+ * The parallel first-solution search finds the same answers as the serial
+ * one, and proves the boards without solution.
+ */
+void testParallelSolve() {
+  SolverOptions options;
+  options.threads = 3;
+  options.sequentialNodes = 1;
+  agreesWithCount("3 threads", options);
+}
+
+/**
+ * The threads of a parallel search share one node budget: together they stop
+ * where a single thread does, not each at a fraction of it.
+ */
+void testParallelBudget() {
+  Sudoku s = board(
+      "800000000003600000070090200050007000000045700000100030001000068008500010"
+      "090000400");
+  for (size_t threads : {1, 3}) {
+    SolverOptions options;
+    options.threads = threads;
+    options.sequentialNodes = 50;
+    options.maxNodes = 300;
+    SearchResult r = solveQuietly(s, options);
+    std::string what = fmt::format("budget of {} threads", threads);
+    check(r.status == Status::OutOfBudget, what + ": status");
+    // Each thread may make one decision after the last check of the budget.
+    check(r.stats.decisions >= options.maxNodes &&
+              r.stats.decisions < options.maxNodes + threads,
+          what + ": decisions");
+  }
+}
+
+/**
+ * The portfolio, whichever strategy wins the race, gives a solution that
+ * keeps the clues, and proves the boards without one. Every strategy of it
+ * agrees with countSolutions on its own.
+ */
+void testPortfolio() {
+  for (const Strategy& strategy : Portfolio::defaults())
+    agreesWithCount(strategy.name, strategy.options,
+                    strategy.options.engine == Engine::LocalSearch);
+  for (const Puzzle& puzzle : puzzles) {
+    Sudoku s = board(puzzle.line);
+    SearchResult count = countSolutions(s, 2);
+    Portfolio portfolio;
+    SearchResult raced = portfolio.solve(s);
+    check(count.status == Status::Unsolvable
+              ? raced.status == Status::Unsolvable
+              : raced.status == Status::Solved && solves(raced.board, s),
+          fmt::format("portfolio on {}", puzzle.line));
+  }
+}
+
+/**
+ * parsePuzzle reads back what formatPuzzle writes, on every board size up to
+ * 49x49, and both refuse larger boards.
+ */
+void testPuzzleLines() {
+  for (size_t n = 2; n <= 8; n++) {
+    size_t N = n * n;
+    vector<int> grid(N * N);
+    for (size_t c = 0; c < grid.size(); c++) grid[c] = (c * 7) % (N + 1);
+    fmt::MemoryWriter line;
+    bool written = formatPuzzle(grid, line);
+    std::string what = fmt::format("{}x{} line", N, N);
+    check(written == (n <= 7), what + ": written");
+    vector<int> read;
+    if (written) {
+      check(parsePuzzle(line.str(), read) && read == grid, what + ": read");
+    } else {
+      check(line.size() == 0, what + ": nothing written");
+      check(!parsePuzzle(std::string(N * N, '.'), read), what + ": refused");
+    }
+  }
+}
+
+/**
+ * The bit-sliced engine agrees with countSolutions, on one puzzle at a time
+ * and with more 9x9 puzzles than lanes, which then take turns.
+ */
+void testBitSliced() {
+  SolverOptions options;
+  options.engine = Engine::BitSliced;
+  agreesWithCount("bit sliced", options);
+
+  vector<vector<int>> grids;
+  vector<SearchResult> counts;
+  while (grids.size() <= 2 * BitSlicedSolver::lanes)
+    for (const Puzzle& puzzle : puzzles) {
+      Sudoku s = board(puzzle.line);
+      if (s.dimension() != 9) continue;
+      grids.push_back(s.grid());
+      counts.push_back(countSolutions(s, 2));
+    }
+  BitSlicedSolver lanes;
+  vector<BitSlicedSolver::Result> results = lanes.solve(grids);
+  for (size_t i = 0; i < grids.size(); i++) {
+    SearchResult r = fromLanes(results[i]);
+    std::string what = fmt::format("lanes, puzzle {}", i);
+    Sudoku s = Sudoku::fromGrid(grids[i]);
+    if (counts[i].status == Status::Unsolvable)
+      check(r.status == Status::Unsolvable, what + ": status");
+    else
+      check(r.status == Status::Solved && solves(r.board, s),
+            what + ": solution");
+  }
+}
+
+/**
+ * The bit-sliced engine stops on every limit of the budget, not only on its
+ * nodes.
+ */
+void testBitSlicedBudget() {
+  Sudoku s = board(
+      "800000000003600000070090200050007000000045700000100030001000068008500010"
+      "090000400");
+  vector<SolverOptions> limited(3);
+  limited[0].maxNodes = 10;
+  limited[1].maxReductions = 20;
+  limited[2].timeLimit = 1e-9;
+  for (size_t i = 0; i < limited.size(); i++) {
+    limited[i].engine = Engine::BitSliced;
+    SearchResult r = solveQuietly(s, limited[i]);
+    check(r.status == Status::OutOfBudget,
+          fmt::format("bit-sliced budget {}: status", i));
+  }
+}
+
+/**
+ * On boards large enough to split, naked and hidden singles give the same
+ * board whatever the number of threads, the serial path included, also when
+ * the clues clash.
+ */
+void testPropagationThreads() {
+  const size_t n = 6, N = n * n;
+  // A solved board, with most of its cells emptied.
+  vector<int> grid(N * N);
+  std::mt19937 rng(3);
+  for (size_t r = 0; r < N; r++)
+    for (size_t c = 0; c < N; c++)
+      grid[r * N + c] = rng() % 5 < 2 ? (n * (r % n) + r / n + c) % N + 1 : 0;
+  for (bool clash : {false, true}) {
+    // The first two cells of row 0, given the same value.
+    if (clash) grid[0] = grid[1] = 1;
+    Sudoku serial = Sudoku::fromGrid(grid);
+    serial.reduce(PropagationLevel::HiddenSingles);
+    check(serial.isFailed() == clash, "serial propagation: failure");
+    for (size_t threads : {2, 3}) {
+      ThreadTeam team(threads);
+      Sudoku split = Sudoku::fromGrid(grid);
+      split.reduce(PropagationLevel::HiddenSingles, &team);
+      std::string what =
+          fmt::format("{} propagation threads{}", threads,
+                      clash ? " on a clash" : "");
+      check(split.isFailed() == serial.isFailed(), what + ": failure");
+      if (!clash) check(sameCandidates(split, serial), what + ": board");
+    }
+  }
+}
+
+/**
+ * A fake /sys tree below a temporary directory. Removes everything it wrote
+ * when it goes away.
+ */
+class FakeSys {
+public:
+  FakeSys() {
+    char name[] = "/tmp/sudoku-sys-XXXXXX";
+    root = mkdtemp(name) != nullptr ? name : "";
+  }
+  ~FakeSys() {
+    for (size_t i = made.size(); i-- > 0;) std::remove(made[i].c_str());
+    if (!root.empty()) rmdir(root.c_str());
+  }
+
+  /**
+   * Writes text to path, below the root, making its directories.
+   */
+  void write(const std::string& path, const std::string& text) {
+    for (size_t slash = path.find('/'); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+      std::string dir = root + "/" + path.substr(0, slash);
+      if (mkdir(dir.c_str(), 0755) == 0) made.push_back(dir);
+    }
+    std::string file = root + "/" + path;
+    std::ofstream(file) << text << '\n';
+    made.push_back(file);
+  }
+
+  std::string root;
+
+private:
+  vector<std::string> made;
+};
+
+/**
+ * Placement on a dual-socket machine with two cores per socket and two
+ * hardware threads per core, numbered as Linux does: the first thread of
+ * every core, then the siblings. Threads fill node 0, a core at a time,
+ * before node 1; a missing tree is flat. Pinned pools give the same results
+ * as free ones.
+ */
+void testTopology() {
+  FakeSys sys;
+  check(!sys.root.empty(), "topology: temporary directory");
+  sys.write("cpu/online", "0-7");
+  sys.write("node/online", "0-1");
+  sys.write("node/node0/cpulist", "0-1,4-5");
+  sys.write("node/node1/cpulist", "2-3,6-7");
+  for (unsigned cpu = 0; cpu < 8; cpu++) {
+    std::string dir = fmt::format("cpu/cpu{}/topology/", cpu);
+    sys.write(dir + "physical_package_id", std::to_string(cpu / 2 % 2));
+    sys.write(dir + "core_id", std::to_string(cpu % 2));
+  }
+
+  Topology topology(sys.root);
+  check(topology.cpus().size() == 8 && topology.nodes() == 2 &&
+            topology.cores() == 4,
+        "topology: counts");
+  vector<unsigned> order;
+  for (const Topology::Cpu& cpu : topology.placement(10))
+    order.push_back(cpu.id);
+  check(order == vector<unsigned>({0, 1, 4, 5, 2, 3, 6, 7, 0, 1}),
+        "topology: placement");
+
+  // Only the CPUs the process may run on count.
+  Topology allowed(sys.root, {5, 6, 7});
+  check(allowed.nodes() == 2 && allowed.cores() == 3 &&
+            allowed.placement(1)[0].id == 5,
+        "topology: allowed CPUs");
+
+  Topology flat(sys.root + "/missing");
+  check(flat.cpus().size() == 1 && flat.nodes() == 1, "topology: flat");
+
+  // Pinned workers find what free ones do.
+  SolverOptions pinned;
+  pinned.threads = 3;
+  pinned.pinThreads = true;
+  enumeratesAll("pinned threads", pinned);
+}
+}
+
+int main() {
+  testProbing();
+  testLevels();
+  testBackjumping();
+  testSat();
+  testLocalSearch();
+  testRestarts();
+  testVisitor();
+  testCheckpoint();
+  testSolutionDatabase();
+  testNegativeCache();
+  testEditSession();
+  testParallelEnumeration();
+  testParallelSolve();
+  testParallelBudget();
+  testPortfolio();
+  testPuzzleLines();
+  testBitSliced();
+  testBitSlicedBudget();
+  testPropagationThreads();
+  testTopology();
+  if (failures > 0) {
+    fmt::print_colored(fmt::RED, "{} checks failed\n", failures);
+    return 1;
+  }
+  fmt::print_colored(fmt::GREEN, "All checks passed\n");
+  return 0;
+}
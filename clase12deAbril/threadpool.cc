@@ -0,0 +1,191 @@
+#include "threadpool.h"
+#include "topology.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// The pool the calling thread works for, and its index there.
+thread_local const WorkStealingPool* currentPool = nullptr;
+thread_local size_t currentIndex = 0;
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads, bool pinned)
+    : ready(0)
+    , pending(0)
+    , quit(false) {
+  if (threads == 0) threads = 1;
+  queues.resize(threads);
+  std::vector<unsigned> nodes(threads, 0);
+  if (pinned)
+    for (const Topology::Cpu& cpu : Topology::system().placement(threads)) {
+      nodes[cpus.size()] = cpu.node;
+      cpus.push_back(cpu.id);
+    }
+  victims.resize(threads);
+  for (size_t i = 0; i < threads; i++)
+    for (bool local : {true, false})
+      for (size_t k = 1; k < threads; k++) {
+        size_t victim = (i + k) % threads;
+        if ((nodes[victim] == nodes[i]) == local) victims[i].push_back(victim);
+      }
+  for (size_t i = 0; i < threads; i++)
+    workers.emplace_back([this, i] { loop(i); });
+  std::unique_lock<std::mutex> guard(idleLock);
+  done.wait(guard, [this] { return ready == queues.size(); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> guard(idleLock);
+    quit = true;
+  }
+  idle.notify_all();
+  for (std::thread& t : workers) t.join();
+}
+
+size_t WorkStealingPool::worker() const {
+  return currentPool == this ? currentIndex : workers.size();
+}
+
+size_t WorkStealingPool::queued() const {
+  size_t index = worker();
+  if (index == workers.size()) return 0;
+  return queues[index]->size.load(std::memory_order_relaxed);
+}
+
+void WorkStealingPool::spawn(Task task) {
+  size_t index = worker();
+  if (index == workers.size()) index = 0;
+  pending++;
+  {
+    Queue& q = *queues[index];
+    std::lock_guard<std::mutex> guard(q.lock);
+    q.tasks.push_back(std::move(task));
+    q.size.store(q.tasks.size(), std::memory_order_relaxed);
+  }
+  // Taking the lock orders the push before the wait of an idle worker.
+  { std::lock_guard<std::mutex> guard(idleLock); }
+  idle.notify_one();
+}
+
+void WorkStealingPool::run(Task task) {
+  spawn(std::move(task));
+  std::unique_lock<std::mutex> guard(idleLock);
+  done.wait(guard, [this] { return pending == 0; });
+}
+
+/**
+ * Takes a task from the back of the own deque, or else steals one from the
+ * front of another.
+ */
+bool WorkStealingPool::take(size_t index, Task& task) {
+  {
+    Queue& q = *queues[index];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+      q.size.store(q.tasks.size(), std::memory_order_relaxed);
+      return true;
+    }
+  }
+  for (size_t victim : victims[index]) {
+    Queue& q = *queues[victim];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+      q.size.store(q.tasks.size(), std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::loop(size_t index) {
+  currentPool = this;
+  currentIndex = index;
+  if (!cpus.empty()) Topology::pin(cpus[index]);
+  {
+    // Memory is placed on the node of the thread that first touches it.
+    std::unique_lock<std::mutex> guard(idleLock);
+    queues[index].reset(new Queue());
+    if (++ready == queues.size()) done.notify_all();
+    done.wait(guard, [this] { return ready == queues.size(); });
+  }
+  Task task;
+  while (true) {
+    if (take(index, task)) {
+      task();
+      task = nullptr;
+      if (--pending == 0) {
+        std::lock_guard<std::mutex> guard(idleLock);
+        done.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(idleLock);
+    if (quit) return;
+    // Tasks may be spawned without the lock: do not sleep for long.
+    idle.wait_for(guard, std::chrono::milliseconds(1));
+  }
+}
+
+ThreadTeam::ThreadTeam(size_t threads)
+    : body(nullptr)
+    , count(0)
+    , slices(1)
+    , generation(0)
+    , busy(0)
+    , quit(false) {
+  for (size_t i = 1; i < threads; i++)
+    helpers.emplace_back([this, i] { loop(i); });
+}
+
+ThreadTeam::~ThreadTeam() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    quit = true;
+  }
+  start.notify_all();
+  for (std::thread& t : helpers) t.join();
+}
+
+void ThreadTeam::run(size_t count, const Body& body) {
+  size_t slices = std::max<size_t>(std::min(size(), count), 1);
+  if (slices == 1) {
+    body(0, count);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    this->body = &body;
+    this->count = count;
+    this->slices = slices;
+    generation++;
+    busy = helpers.size();
+  }
+  start.notify_all();
+  body(0, count / slices);
+  std::unique_lock<std::mutex> guard(lock);
+  finished.wait(guard, [this] { return busy == 0; });
+}
+
+void ThreadTeam::loop(size_t index) {
+  size_t seen = 0;
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    start.wait(guard, [this, seen] { return quit || generation != seen; });
+    if (quit) return;
+    seen = generation;
+    if (index < slices) {
+      const Body& f = *body;
+      size_t begin = count * index / slices, end = count * (index + 1) / slices;
+      guard.unlock();
+      f(begin, end);
+      guard.lock();
+    }
+    if (--busy == 0) finished.notify_one();
+  }
+}
@@ -0,0 +1,153 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A flag that tells the tasks of a search to give up, for instance once one
+ * of them has found what the search was after. Checking it is a relaxed load,
+ * cheap enough for every node of a search.
+ */
+class CancellationToken {
+public:
+  CancellationToken()
+      : flag(false) {}
+
+  void cancel() { flag.store(true, std::memory_order_relaxed); }
+  bool cancelled() const { return flag.load(std::memory_order_relaxed); }
+
+private:
+  CancellationToken(const CancellationToken&);
+  CancellationToken& operator=(const CancellationToken&);
+
+  std::atomic<bool> flag;
+};
+
+/**
+ * A pool of threads with work stealing, for divide and conquer searches.
+ *
+ * Every worker owns a deque of tasks. Tasks spawned by a worker go to the
+ * back of its own deque, and it takes its next task from the back too, so
+ * that it works depth first on the subtree it is in. A worker with nothing to
+ * do steals from the front of the deque of another one, where the oldest and
+ * usually largest subtrees are.
+ *
+ * A pinned pool places its workers with Topology::placement, one NUMA node
+ * after the other. Every worker allocates its own deque once it runs on its
+ * CPU, so that the deque lives on the memory of its node, and it steals from
+ * the workers of its node before trying those of other nodes.
+ */
+class WorkStealingPool {
+public:
+  using Task = std::function<void()>;
+
+  explicit WorkStealingPool(size_t threads, bool pinned = false);
+  ~WorkStealingPool();
+
+  size_t size() const { return workers.size(); }
+
+  /**
+   * Runs task on the pool and waits until it, and every task spawned from
+   * it, is done.
+   */
+  void run(Task task);
+
+  /**
+   * Adds a task, to the deque of the calling worker if called from one.
+   */
+  void spawn(Task task);
+
+  /**
+   * Tasks waiting in the deque of the calling worker, a relaxed read that may
+   * be slightly out of date.
+   */
+  size_t queued() const;
+
+  /**
+   * Index of the calling worker in [0, size()), or size() if the caller is not
+   * a worker of this pool.
+   */
+  size_t worker() const;
+
+private:
+  struct Queue {
+    Queue()
+        : size(0) {}
+
+    std::mutex lock;
+    std::deque<Task> tasks;
+    // The size of tasks, written under lock and read without it.
+    std::atomic<size_t> size;
+  };
+
+  WorkStealingPool(const WorkStealingPool&);
+  WorkStealingPool& operator=(const WorkStealingPool&);
+
+  void loop(size_t index);
+  bool take(size_t index, Task& task);
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  // The workers to steal from, by worker: those of its node first.
+  std::vector<std::vector<size_t>> victims;
+  // CPU of every worker, none if the pool is not pinned.
+  std::vector<unsigned> cpus;
+  std::vector<std::thread> workers;
+  // Workers that have allocated their deque, the others wait for them.
+  size_t ready;
+  // Tasks spawned and not finished yet.
+  std::atomic<size_t> pending;
+  std::atomic<bool> quit;
+  std::mutex idleLock;
+  std::condition_variable idle;
+  std::condition_variable done;
+};
+
+/**
+ * Threads that stay around to run the slices of short parallel loops, which
+ * could not pay for starting threads every time.
+ *
+ * run(count, body) calls body(begin, end) on consecutive slices of [0, count),
+ * at most one per member of the team, and returns once all are done. The
+ * calling thread is a member and takes the first slice. The slices only depend
+ * on count and size(). Only one thread at a time may call run.
+ */
+class ThreadTeam {
+public:
+  using Body = std::function<void(size_t, size_t)>;
+
+  explicit ThreadTeam(size_t threads);
+  ~ThreadTeam();
+
+  size_t size() const { return helpers.size() + 1; }
+
+  void run(size_t count, const Body& body);
+
+private:
+  ThreadTeam(const ThreadTeam&);
+  ThreadTeam& operator=(const ThreadTeam&);
+
+  void loop(size_t index);
+
+  std::vector<std::thread> helpers;
+  std::mutex lock;
+  std::condition_variable start;
+  std::condition_variable finished;
+  // The loop being run, and how it is sliced.
+  const Body* body;
+  size_t count;
+  size_t slices;
+  // Loops run so far, and helpers still busy with the last one.
+  size_t generation;
+  size_t busy;
+  bool quit;
+};
+
+#endif  // THREADPOOL_H_
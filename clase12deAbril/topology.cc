@@ -0,0 +1,130 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <tuple>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+/**
+ * Parses a list of CPUs or nodes as /sys writes them, such as "0-3,8-11".
+ */
+std::vector<unsigned> parseList(const std::string& text) {
+  std::vector<unsigned> ids;
+  std::stringstream in(text);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    unsigned first, last;
+    char dash;
+    std::stringstream r(range);
+    if (!(r >> first)) continue;
+    if (!(r >> dash >> last)) last = first;
+    for (unsigned id = first; id <= last; id++) ids.push_back(id);
+  }
+  return ids;
+}
+
+std::string readLine(const std::string& path) {
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return line;
+}
+
+bool readNumber(const std::string& path, unsigned& value) {
+  std::ifstream in(path);
+  return bool(in >> value);
+}
+
+std::vector<unsigned> allowedCpus() {
+  std::vector<unsigned> ids;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    for (unsigned id = 0; id < CPU_SETSIZE; id++)
+      if (CPU_ISSET(id, &set)) ids.push_back(id);
+#endif
+  return ids;
+}
+}
+
+const Topology& Topology::system() {
+  static const Topology topology("/sys/devices/system", allowedCpus());
+  return topology;
+}
+
+Topology::Topology(const std::string& root,
+                   const std::vector<unsigned>& allowed)
+    : nodeCount(1)
+    , coreCount(0) {
+  std::vector<unsigned> ids = allowed;
+  if (ids.empty()) ids = parseList(readLine(root + "/cpu/online"));
+  if (ids.empty()) ids.push_back(0);
+
+  std::vector<std::pair<unsigned, unsigned>> nodeOf;
+  for (unsigned node : parseList(readLine(root + "/node/online")))
+    for (unsigned cpu : parseList(readLine(root + "/node/node" +
+                                           std::to_string(node) + "/cpulist")))
+      nodeOf.push_back({cpu, node});
+
+  std::set<unsigned> nodes;
+  std::set<std::pair<unsigned, unsigned>> cores;
+  for (unsigned id : ids) {
+    Cpu cpu{id, 0, 0, id};
+    for (const auto& n : nodeOf)
+      if (n.first == id) cpu.node = n.second;
+    std::string dir = root + "/cpu/cpu" + std::to_string(id) + "/topology/";
+    readNumber(dir + "physical_package_id", cpu.package);
+    readNumber(dir + "core_id", cpu.core);
+    all.push_back(cpu);
+    nodes.insert(cpu.node);
+    cores.insert({cpu.package, cpu.core});
+  }
+  nodeCount = nodes.size();
+  coreCount = cores.size();
+}
+
+std::vector<Topology::Cpu> Topology::placement(size_t threads) const {
+  // Rank of every CPU among the hardware threads of its core.
+  using Ranked = std::pair<size_t, Cpu>;
+  std::vector<Ranked> ranked;
+  for (size_t i = 0; i < all.size(); i++) {
+    size_t rank = 0;
+    for (size_t k = 0; k < i; k++)
+      if (all[k].package == all[i].package && all[k].core == all[i].core)
+        rank++;
+    ranked.push_back({rank, all[i]});
+  }
+  std::sort(ranked.begin(), ranked.end(),
+            [](const Ranked& a, const Ranked& b) {
+              return std::make_tuple(a.second.node, a.first, a.second.package,
+                                     a.second.core, a.second.id) <
+                     std::make_tuple(b.second.node, b.first, b.second.package,
+                                     b.second.core, b.second.id);
+            });
+  std::vector<Cpu> cpus;
+  for (size_t t = 0; t < threads; t++)
+    cpus.push_back(ranked[t % ranked.size()].second);
+  return cpus;
+}
+
+bool Topology::pin(unsigned cpu) {
+#ifdef __linux__
+  if (cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
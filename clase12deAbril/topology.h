@@ -0,0 +1,61 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * The processors the process may run on, as Linux describes them in /sys:
+ * the NUMA node, package (socket) and physical core of every CPU.
+ *
+ * Anything missing from /sys counts as one node and one package with a core
+ * per CPU, so the topology of a machine without NUMA, or of another system,
+ * is simply flat.
+ */
+class Topology {
+public:
+  struct Cpu {
+    unsigned id;
+    unsigned node;
+    unsigned package;
+    unsigned core;
+  };
+
+  /**
+   * The topology of this machine, read once.
+   */
+  static const Topology& system();
+
+  /**
+   * Reads the topology below root, normally /sys/devices/system, of the CPUs
+   * in allowed, or of every online CPU if it is empty.
+   */
+  explicit Topology(const std::string& root,
+                    const std::vector<unsigned>& allowed = {});
+
+  const std::vector<Cpu>& cpus() const { return all; }
+  size_t nodes() const { return nodeCount; }
+  size_t cores() const { return coreCount; }
+
+  /**
+   * CPUs for the given number of threads, in order. Nodes are filled one
+   * after the other, so that a few threads share the memory of one node, and
+   * within a node every physical core gets a thread before any gets a second
+   * one on a sibling. More threads than CPUs wrap around.
+   */
+  std::vector<Cpu> placement(size_t threads) const;
+
+  /**
+   * Pins the calling thread to cpu. Returns false if the system does not
+   * allow it.
+   */
+  static bool pin(unsigned cpu);
+
+private:
+  std::vector<Cpu> all;
+  size_t nodeCount;
+  size_t coreCount;
+};
+
+#endif  // TOPOLOGY_H_